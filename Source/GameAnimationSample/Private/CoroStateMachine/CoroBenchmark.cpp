@@ -0,0 +1,505 @@
+#include "CoroStateMachine/CoroStateMachine.h"
+#include "CoroStateMachine/CoroStaticStateGraph.h"
+
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/DateTime.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include <deque>
+#include <functional>
+#include <stack>
+#include <vector>
+
+#if !UE_BUILD_SHIPPING
+
+//Microbenchmarks for the coroutine state machine, run with Coro.Benchmark [Iterations].
+//Results are logged and written as JSON to Saved/Profiling/CoroBenchmark so runs can be diffed between releases.
+namespace CoroBenchmark
+{
+	volatile int32 Sink{0};
+
+	struct FResult
+	{
+		FString Name;
+		int32 Param{0};
+		double NanosecondsPerOp{0.0};
+		uint64 Bytes{0};
+	};
+
+	template <typename FuncType>
+	double NanosecondsPerOp(const int32 Iterations, FuncType&& Body)
+	{
+		//One untimed pass so every frame size class is already warm in the pool.
+		Body();
+		const uint64 Start = FPlatformTime::Cycles64();
+		for (int32 i = 0; i < Iterations; ++i)
+		{
+			Body();
+		}
+		const uint64 Cycles = FPlatformTime::Cycles64() - Start;
+		return FPlatformTime::ToMilliseconds64(Cycles) * 1000000.0 / Iterations;
+	}
+
+	CoroState IdleState()
+	{
+		while (true)
+		{
+			co_await suspend_always{};
+		}
+	}
+
+	CoroState StateWithLocals()
+	{
+		FVector Positions[16]{};
+		int32 Index = 0;
+		while (true)
+		{
+			Positions[Index++ % 16] += FVector::OneVector;
+			Sink = Sink + static_cast<int32>(Positions[0].X);
+			co_await suspend_always{};
+		}
+	}
+
+	CoroTask<int32> NestedTask(CoroStateMachine& SM, const int32 Depth)
+	{
+		if (Depth == 0)
+		{
+			co_return 1;
+		}
+		co_return 1 + co_await SM.WaitForTask(NestedTask(SM, Depth - 1));
+	}
+
+	CoroState NestingState(CoroStateMachine& SM, const int32 Depth)
+	{
+		while (true)
+		{
+			Sink = co_await SM.WaitForTask(NestedTask(SM, Depth));
+			co_await suspend_always{};
+		}
+	}
+
+	//Changes to a fresh copy of itself on every Run.
+	CoroState FlipState(CoroStateMachine& SM)
+	{
+		SM.AddTransition([] { return true; }, [&SM] { return FlipState(SM); });
+		while (true)
+		{
+			co_await suspend_always{};
+		}
+	}
+
+	//A locomotion/parkour shaped graph, the predicates read plain inputs like the real component does.
+	enum class ELocomotionState : uint8
+	{
+		Idle,
+		Walk,
+		Sprint,
+		Traverse,
+		Fall
+	};
+
+	struct FLocomotionContext
+	{
+		float Speed{0.0f};
+		bool bGrounded{true};
+		bool bWantsToTraverse{false};
+
+		bool IsMoving() { return Speed > 10.0f; }
+		bool IsStopped() { return Speed <= 10.0f; }
+		bool IsSprinting() { return Speed > 500.0f; }
+		bool IsWalking() { return Speed <= 500.0f; }
+		bool WantsToTraverse() { return bWantsToTraverse; }
+		bool IsFalling() { return !bGrounded; }
+		bool IsLanded() { return bGrounded; }
+
+		CoroState Idle() { return IdleState(); }
+		CoroState Walk() { return IdleState(); }
+		CoroState Sprint() { return IdleState(); }
+		CoroState Traverse() { return IdleState(); }
+		CoroState Fall() { return IdleState(); }
+	};
+
+	using FStaticLocomotionGraph = CoroStaticStateGraph<
+		FLocomotionContext, ELocomotionState::Idle,
+		CoroTypeList<
+			CoroStaticState<ELocomotionState::Idle, &FLocomotionContext::Idle>,
+			CoroStaticState<ELocomotionState::Walk, &FLocomotionContext::Walk>,
+			CoroStaticState<ELocomotionState::Sprint, &FLocomotionContext::Sprint>,
+			CoroStaticState<ELocomotionState::Traverse, &FLocomotionContext::Traverse>,
+			CoroStaticState<ELocomotionState::Fall, &FLocomotionContext::Fall>>,
+		CoroTypeList<
+			CoroStaticTransition<ELocomotionState::Idle, &FLocomotionContext::IsFalling, ELocomotionState::Fall>,
+			CoroStaticTransition<ELocomotionState::Idle, &FLocomotionContext::WantsToTraverse, ELocomotionState::Traverse>,
+			CoroStaticTransition<ELocomotionState::Idle, &FLocomotionContext::IsMoving, ELocomotionState::Walk>,
+			CoroStaticTransition<ELocomotionState::Walk, &FLocomotionContext::IsFalling, ELocomotionState::Fall>,
+			CoroStaticTransition<ELocomotionState::Walk, &FLocomotionContext::WantsToTraverse, ELocomotionState::Traverse>,
+			CoroStaticTransition<ELocomotionState::Walk, &FLocomotionContext::IsSprinting, ELocomotionState::Sprint>,
+			CoroStaticTransition<ELocomotionState::Walk, &FLocomotionContext::IsStopped, ELocomotionState::Idle>,
+			CoroStaticTransition<ELocomotionState::Sprint, &FLocomotionContext::IsFalling, ELocomotionState::Fall>,
+			CoroStaticTransition<ELocomotionState::Sprint, &FLocomotionContext::WantsToTraverse, ELocomotionState::Traverse>,
+			CoroStaticTransition<ELocomotionState::Sprint, &FLocomotionContext::IsWalking, ELocomotionState::Walk>,
+			CoroStaticTransition<ELocomotionState::Traverse, &FLocomotionContext::IsLanded, ELocomotionState::Idle>,
+			CoroStaticTransition<ELocomotionState::Fall, &FLocomotionContext::IsLanded, ELocomotionState::Idle>>>;
+
+	static_assert(FStaticLocomotionGraph::AllStatesReachable());
+
+	//The same graph wired through the runtime API, each state adds the transitions leaving it when it starts.
+	struct FDynamicLocomotionGraph
+	{
+		FLocomotionContext& Context;
+		CoroStateMachine Machine;
+
+		explicit FDynamicLocomotionGraph(FLocomotionContext& InContext) : Context{InContext}
+		{
+		}
+
+		void Start()
+		{
+			Machine.ChangeToState(State(ELocomotionState::Idle));
+		}
+
+		void Add(bool (FLocomotionContext::*Predicate)(), const ELocomotionState To)
+		{
+			Machine.AddTransition([this, Predicate] { return (Context.*Predicate)(); },
+			                      [this, To] { return State(To); });
+		}
+
+		CoroState State(const ELocomotionState Id)
+		{
+			switch (Id)
+			{
+			case ELocomotionState::Idle:
+				Add(&FLocomotionContext::IsFalling, ELocomotionState::Fall);
+				Add(&FLocomotionContext::WantsToTraverse, ELocomotionState::Traverse);
+				Add(&FLocomotionContext::IsMoving, ELocomotionState::Walk);
+				break;
+			case ELocomotionState::Walk:
+				Add(&FLocomotionContext::IsFalling, ELocomotionState::Fall);
+				Add(&FLocomotionContext::WantsToTraverse, ELocomotionState::Traverse);
+				Add(&FLocomotionContext::IsSprinting, ELocomotionState::Sprint);
+				Add(&FLocomotionContext::IsStopped, ELocomotionState::Idle);
+				break;
+			case ELocomotionState::Sprint:
+				Add(&FLocomotionContext::IsFalling, ELocomotionState::Fall);
+				Add(&FLocomotionContext::WantsToTraverse, ELocomotionState::Traverse);
+				Add(&FLocomotionContext::IsWalking, ELocomotionState::Walk);
+				break;
+			default:
+				Add(&FLocomotionContext::IsLanded, ELocomotionState::Idle);
+				break;
+			}
+			while (true)
+			{
+				co_await suspend_always{};
+			}
+		}
+	};
+
+	//Run's hot path as it was before the machine went allocation free: std::function transitions in a deque that's
+	//rotated by copy, stateless tasks in a vector and awaited tasks in a stack. Kept so the Baseline rows can be read
+	//against Resume and TransitionsRoundRobin.
+	struct FBaselineMachine
+	{
+		struct FTransition
+		{
+			std::function<bool()> TransFunc;
+			std::function<CoroState()> StateFunc;
+		};
+
+		std::coroutine_handle<> CurrentTask{nullptr};
+		std::stack<std::coroutine_handle<>> CoroutineStack;
+		std::deque<FTransition> Transitions;
+		std::vector<std::function<void()>> StatelessTasks;
+
+		explicit FBaselineMachine(const CoroState& State) : CurrentTask{State.Handle}
+		{
+		}
+
+		~FBaselineMachine()
+		{
+			FreeEntireCoroutineStack();
+		}
+
+		void FreeEntireCoroutineStack()
+		{
+			if (CurrentTask)
+			{
+				CurrentTask.destroy();
+				CurrentTask = nullptr;
+			}
+			while (!CoroutineStack.empty())
+			{
+				CoroutineStack.top().destroy();
+				CoroutineStack.pop();
+			}
+		}
+
+		std::function<CoroState()> CheckNextTransition()
+		{
+			if (Transitions.empty())
+			{
+				return nullptr;
+			}
+
+			auto& [TransFunc, StateFunc] = Transitions.front();
+			if (TransFunc())
+			{
+				return StateFunc;
+			}
+
+			Transitions.push_back(Transitions.front());
+			Transitions.pop_front();
+			return nullptr;
+		}
+
+		bool Run()
+		{
+			for (const auto& StatelessTask : StatelessTasks)
+			{
+				StatelessTask();
+			}
+
+			if (const auto CheckResult = CheckNextTransition())
+			{
+				FreeEntireCoroutineStack();
+				Transitions.clear();
+				CurrentTask = CheckResult().Handle;
+			}
+
+			while (!CurrentTask || CurrentTask.done())
+			{
+				if (CoroutineStack.empty())
+				{
+					return false;
+				}
+				if (CurrentTask)
+				{
+					CurrentTask.destroy();
+				}
+				CurrentTask = CoroutineStack.top();
+				CoroutineStack.pop();
+			}
+
+			CurrentTask.resume();
+			return true;
+		}
+	};
+
+	void RunBaseline(TArray<FResult>& Results, const int32 Iterations)
+	{
+		{
+			FBaselineMachine Machine{IdleState()};
+			Results.Add({TEXT("BaselineResume"), 0, NanosecondsPerOp(Iterations, [&] { Machine.Run(); })});
+		}
+		for (int32 Count = 1; Count <= CoroStateMachine::MaxTransitions; Count *= 2)
+		{
+			FBaselineMachine Machine{IdleState()};
+			for (int32 i = 0; i < Count; ++i)
+			{
+				Machine.Transitions.push_back({[i] { return Sink == -1 - i; }, [] { return IdleState(); }});
+			}
+			Results.Add({
+				TEXT("BaselineTransitionsRoundRobin"), Count, NanosecondsPerOp(Iterations, [&] { Machine.Run(); })
+			});
+		}
+	}
+
+	//Speeds walk the graph through idle, walk and sprint so both forms take real transitions.
+	float SpeedForIteration(const int32 Iteration)
+	{
+		static constexpr float Speeds[] = {0.0f, 0.0f, 200.0f, 200.0f, 800.0f, 800.0f, 200.0f, 0.0f};
+		return Speeds[Iteration % UE_ARRAY_COUNT(Speeds)];
+	}
+
+	void RunResume(TArray<FResult>& Results, const int32 Iterations)
+	{
+		CoroStateMachine Machine;
+		Machine.ChangeToState(IdleState());
+		Results.Add({TEXT("Resume"), 0, NanosecondsPerOp(Iterations, [&] { Machine.Run(); })});
+		Machine.Destroy();
+	}
+
+	void RunChangeToState(TArray<FResult>& Results, const int32 Iterations)
+	{
+		CoroStateMachine Machine;
+		Results.Add({TEXT("ChangeToState"), 0, NanosecondsPerOp(Iterations, [&] { Machine.ChangeToState(IdleState()); })});
+		Machine.Destroy();
+	}
+
+	void RunTransitions(TArray<FResult>& Results, const int32 Iterations)
+	{
+		for (const auto Mode : {ECoroTransitionEvaluation::RoundRobin, ECoroTransitionEvaluation::Priority})
+		{
+			for (int32 Count = 1; Count <= CoroStateMachine::MaxTransitions; Count *= 2)
+			{
+				CoroStateMachine Machine;
+				Machine.ChangeToState(IdleState());
+				Machine.SetTransitionEvaluation(Mode);
+				for (int32 i = 0; i < Count; ++i)
+				{
+					Machine.AddTransition([i] { return Sink == -1 - i; }, [] { return IdleState(); });
+				}
+				Results.Add({
+					Mode == ECoroTransitionEvaluation::Priority ? TEXT("TransitionsPriority") : TEXT("TransitionsRoundRobin"),
+					Count, NanosecondsPerOp(Iterations, [&] { Machine.Run(); })
+				});
+				Machine.Destroy();
+			}
+		}
+	}
+
+	void RunNesting(TArray<FResult>& Results, const int32 Iterations)
+	{
+		for (const int32 Depth : {1, 8, 64, 256})
+		{
+			CoroStateMachine Machine;
+			Machine.ChangeToState(NestingState(Machine, Depth));
+			//Two Runs per op, one resolves the whole chain and one resumes past the suspend.
+			const double Nanoseconds = NanosecondsPerOp(Iterations / Depth + 1, [&]
+			{
+				Machine.Run();
+				Machine.Run();
+			});
+			Results.Add({TEXT("WaitForTaskNesting"), Depth, Nanoseconds});
+			Machine.Destroy();
+		}
+	}
+
+	void RunFrameMemory(TArray<FResult>& Results)
+	{
+		auto Measure = [&Results](const TCHAR* Name, auto&& Construct)
+		{
+			CoroFramePool::ResetStats();
+			CoroStateMachine Machine;
+			Machine.ChangeToState(Construct(Machine));
+			Results.Add({Name, 0, 0.0, CoroFramePool::GetStats().LargestFrame});
+			Machine.Destroy();
+		};
+		Measure(TEXT("FrameBytesIdleState"), [](CoroStateMachine&) { return IdleState(); });
+		Measure(TEXT("FrameBytesStateWithLocals"), [](CoroStateMachine&) { return StateWithLocals(); });
+		Measure(TEXT("FrameBytesNestingState"), [](CoroStateMachine& SM) { return NestingState(SM, 1); });
+	}
+
+	//Once the pool is warm, transitions and awaited tasks must be served from the free lists alone.
+	void RunSteadyStateAllocations(TArray<FResult>& Results, const int32 Iterations)
+	{
+		CoroStateMachine FlipMachine;
+		FlipMachine.ChangeToState(FlipState(FlipMachine));
+		CoroStateMachine NestingMachine;
+		NestingMachine.ChangeToState(NestingState(NestingMachine, 8));
+		auto Step = [&]
+		{
+			FlipMachine.Run();
+			NestingMachine.Run();
+			NestingMachine.Run();
+		};
+		Step();
+		Step();
+
+		//ResetStats keeps the chunk count, so the chunks are counted from here.
+		CoroFramePool::ResetStats();
+		const uint64 ChunksBefore = CoroFramePool::GetStats().ChunkAllocations;
+		for (int32 i = 0; i < Iterations; ++i)
+		{
+			Step();
+		}
+		const auto Stats = CoroFramePool::GetStats();
+		const uint64 GlobalAllocations = Stats.ChunkAllocations - ChunksBefore + Stats.OversizedAllocations;
+
+		UE_LOG(LogTemp, Log, TEXT("CoroBenchmark steady state: %llu frame allocations, %llu from the global allocator"),
+		       Stats.Allocations, GlobalAllocations);
+		ensureMsgf(GlobalAllocations == 0,
+		           TEXT("Steady state transitions touched the global allocator %llu times"), GlobalAllocations);
+		Results.Add({TEXT("SteadyStateGlobalAllocations"), Iterations, 0.0, GlobalAllocations});
+
+		FlipMachine.Destroy();
+		NestingMachine.Destroy();
+	}
+
+	void RunLocomotionGraphs(TArray<FResult>& Results, const int32 Iterations)
+	{
+		{
+			FLocomotionContext Context;
+			FStaticLocomotionGraph Graph{Context};
+			Graph.Start();
+			int32 Iteration = 0;
+			Results.Add({
+				TEXT("LocomotionGraphStatic"), 0, NanosecondsPerOp(Iterations, [&]
+				{
+					Context.Speed = SpeedForIteration(Iteration++);
+					Graph.Run();
+				})
+			});
+			Graph.Destroy();
+		}
+		{
+			FLocomotionContext Context;
+			FDynamicLocomotionGraph Graph{Context};
+			Graph.Machine.SetTransitionEvaluation(ECoroTransitionEvaluation::Priority);
+			Graph.Start();
+			int32 Iteration = 0;
+			Results.Add({
+				TEXT("LocomotionGraphDynamic"), 0, NanosecondsPerOp(Iterations, [&]
+				{
+					Context.Speed = SpeedForIteration(Iteration++);
+					Graph.Machine.MarkDirty(~0u);
+					Graph.Machine.Run();
+				})
+			});
+			Graph.Machine.Destroy();
+		}
+	}
+
+	FString ToJson(const TArray<FResult>& Results, const int32 Iterations)
+	{
+		FString Json = FString::Printf(TEXT("{\n\t\"timestamp\": \"%s\",\n\t\"iterations\": %d,\n\t\"results\": [\n"),
+		                               *FDateTime::UtcNow().ToIso8601(), Iterations);
+		for (int32 i = 0; i < Results.Num(); ++i)
+		{
+			const auto& Result = Results[i];
+			Json += FString::Printf(
+				TEXT("\t\t{\"name\": \"%s\", \"param\": %d, \"ns_per_op\": %.3f, \"bytes\": %llu}%s\n"),
+				*Result.Name, Result.Param, Result.NanosecondsPerOp, Result.Bytes, i + 1 < Results.Num() ? TEXT(",") : TEXT(""));
+		}
+		Json += TEXT("\t]\n}\n");
+		return Json;
+	}
+
+	void Run(const TArray<FString>& Args)
+	{
+		const int32 Iterations = Args.Num() > 0 ? FMath::Max(1, FCString::Atoi(*Args[0])) : 100000;
+
+		TArray<FResult> Results;
+		RunResume(Results, Iterations);
+		RunBaseline(Results, Iterations);
+		RunChangeToState(Results, Iterations);
+		RunTransitions(Results, Iterations);
+		RunNesting(Results, Iterations);
+		RunFrameMemory(Results);
+		RunSteadyStateAllocations(Results, Iterations);
+		RunLocomotionGraphs(Results, Iterations);
+
+		for (const auto& Result : Results)
+		{
+			UE_LOG(LogTemp, Log, TEXT("CoroBenchmark %s(%d): %.1f ns/op, %llu bytes"),
+			       *Result.Name, Result.Param, Result.NanosecondsPerOp, Result.Bytes);
+		}
+
+		const FString Path = FPaths::ProfilingDir() / TEXT("CoroBenchmark") /
+			FString::Printf(TEXT("CoroBenchmark-%s.json"), *FDateTime::Now().ToString());
+		if (FFileHelper::SaveStringToFile(ToJson(Results, Iterations), *Path))
+		{
+			UE_LOG(LogTemp, Log, TEXT("CoroBenchmark results written to %s"),
+			       *IFileManager::Get().ConvertToAbsolutePathForExternalAppForWrite(*Path));
+		}
+	}
+}
+
+static FAutoConsoleCommand CoroBenchmarkCommand(
+	TEXT("Coro.Benchmark"),
+	TEXT("Runs the coroutine state machine microbenchmarks and writes the results as JSON. Usage: Coro.Benchmark [Iterations]"),
+	FConsoleCommandWithArgsDelegate::CreateLambda(&CoroBenchmark::Run));
+
+#endif
@@ -0,0 +1,48 @@
+#include "CoroStateMachine/CoroEvent.h"
+
+#include "CoroStateMachine/CoroStateMachine.h"
+
+void CoroEventWaiter::Cancel()
+{
+	if (IsWaiting())
+	{
+		Prev->Next = Next;
+		Next->Prev = Prev;
+		Next = nullptr;
+		Prev = nullptr;
+	}
+}
+
+CoroEvent::CoroEvent()
+{
+	Head.Next = &Head;
+	Head.Prev = &Head;
+}
+
+CoroEvent::~CoroEvent()
+{
+	//Nobody could signal these anymore, wake them rather than leaving them asleep forever.
+	Signal();
+}
+
+void CoroEvent::Signal()
+{
+	while (HasWaiters())
+	{
+		auto& Waiter = *Head.Next;
+		Waiter.Cancel();
+		if (Waiter.Machine)
+		{
+			Waiter.Machine->Wake();
+		}
+	}
+}
+
+void CoroEvent::AddWaiter(CoroEventWaiter& Waiter)
+{
+	Waiter.Cancel();
+	Waiter.Prev = Head.Prev;
+	Waiter.Next = &Head;
+	Head.Prev->Next = &Waiter;
+	Head.Prev = &Waiter;
+}
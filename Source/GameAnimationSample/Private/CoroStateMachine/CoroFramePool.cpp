@@ -0,0 +1,147 @@
+#include "CoroStateMachine/CoroFramePool.h"
+
+#include "HAL/IConsoleManager.h"
+#include <atomic>
+
+namespace
+{
+	struct FreeFrame
+	{
+		FreeFrame* Next;
+	};
+
+	thread_local FreeFrame* FreeLists[CoroFramePool::NumSizeClasses]{};
+	thread_local uint8* ChunkCursor{nullptr};
+	thread_local uint8* ChunkEnd{nullptr};
+
+	std::atomic<uint64> Allocations{0};
+	std::atomic<uint64> PoolHits{0};
+	std::atomic<uint64> ChunkAllocations{0};
+	std::atomic<uint64> OversizedAllocations{0};
+	std::atomic<uint64> LargestFrame{0};
+	std::atomic<uint64> SizeClassAllocations[CoroFramePool::NumSizeClasses]{};
+
+	size_t GetSizeClass(const size_t Size)
+	{
+		return (Size - 1) / CoroFramePool::SizeClassGranularity;
+	}
+
+	void RecordLargestFrame(const uint64 Size)
+	{
+		uint64 Current = LargestFrame.load(std::memory_order_relaxed);
+		while (Current < Size && !LargestFrame.compare_exchange_weak(Current, Size, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	void* CarveFromChunk(const size_t ClassSize)
+	{
+		if (ChunkCursor + ClassSize > ChunkEnd)
+		{
+			//The tail of the previous chunk is abandoned, it's smaller than the frame we need.
+			ChunkCursor = static_cast<uint8*>(FMemory::Malloc(CoroFramePool::ChunkSize,
+			                                                  CoroFramePool::SizeClassGranularity));
+			ChunkEnd = ChunkCursor + CoroFramePool::ChunkSize;
+			ChunkAllocations.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			//Only a new chunk reaches the global allocator, carving from one we own is as good as a free list pop.
+			PoolHits.fetch_add(1, std::memory_order_relaxed);
+		}
+		void* Frame = ChunkCursor;
+		ChunkCursor += ClassSize;
+		return Frame;
+	}
+}
+
+void* CoroFramePool::Allocate(const size_t Size)
+{
+	Allocations.fetch_add(1, std::memory_order_relaxed);
+	RecordLargestFrame(Size);
+
+	if (Size == 0 || Size > MaxPooledFrameSize)
+	{
+		OversizedAllocations.fetch_add(1, std::memory_order_relaxed);
+		return FMemory::Malloc(Size, SizeClassGranularity);
+	}
+
+	const auto SizeClass = GetSizeClass(Size);
+	SizeClassAllocations[SizeClass].fetch_add(1, std::memory_order_relaxed);
+
+	if (FreeFrame* Frame = FreeLists[SizeClass])
+	{
+		FreeLists[SizeClass] = Frame->Next;
+		PoolHits.fetch_add(1, std::memory_order_relaxed);
+		return Frame;
+	}
+
+	return CarveFromChunk((SizeClass + 1) * SizeClassGranularity);
+}
+
+void CoroFramePool::Free(void* Frame, const size_t Size) noexcept
+{
+	if (!Frame)
+	{
+		return;
+	}
+
+	if (Size == 0 || Size > MaxPooledFrameSize)
+	{
+		FMemory::Free(Frame);
+		return;
+	}
+
+	//Frames freed on another thread simply migrate to that thread's free list.
+	const auto SizeClass = GetSizeClass(Size);
+	const auto Node = static_cast<FreeFrame*>(Frame);
+	Node->Next = FreeLists[SizeClass];
+	FreeLists[SizeClass] = Node;
+}
+
+CoroFramePoolStats CoroFramePool::GetStats()
+{
+	CoroFramePoolStats Stats;
+	Stats.Allocations = Allocations.load(std::memory_order_relaxed);
+	Stats.PoolHits = PoolHits.load(std::memory_order_relaxed);
+	Stats.ChunkAllocations = ChunkAllocations.load(std::memory_order_relaxed);
+	Stats.OversizedAllocations = OversizedAllocations.load(std::memory_order_relaxed);
+	Stats.LargestFrame = LargestFrame.load(std::memory_order_relaxed);
+	for (size_t i = 0; i < NumSizeClasses; ++i)
+	{
+		Stats.SizeClassAllocations[i] = SizeClassAllocations[i].load(std::memory_order_relaxed);
+	}
+	return Stats;
+}
+
+void CoroFramePool::ResetStats()
+{
+	Allocations = 0;
+	PoolHits = 0;
+	OversizedAllocations = 0;
+	LargestFrame = 0;
+	for (auto& Count : SizeClassAllocations)
+	{
+		Count = 0;
+	}
+	//ChunkAllocations is intentionally kept, it tracks memory that's still owned by the pool.
+}
+
+static FAutoConsoleCommand CoroFramePoolStatsCommand(
+	TEXT("Coro.FramePool.Stats"),
+	TEXT("Logs coroutine frame pool allocation stats."),
+	FConsoleCommandDelegate::CreateLambda([]
+	{
+		const auto Stats = CoroFramePool::GetStats();
+		UE_LOG(LogTemp, Log, TEXT("Coro frames: %llu allocations, %.1f%% pool hits, %llu chunks, %llu oversized, largest %llu bytes"),
+		       Stats.Allocations, Stats.GetHitRate() * 100.0, Stats.ChunkAllocations, Stats.OversizedAllocations,
+		       Stats.LargestFrame);
+		for (size_t i = 0; i < CoroFramePool::NumSizeClasses; ++i)
+		{
+			if (Stats.SizeClassAllocations[i])
+			{
+				UE_LOG(LogTemp, Log, TEXT("  <= %llu bytes: %llu"),
+				       static_cast<uint64>((i + 1) * CoroFramePool::SizeClassGranularity), Stats.SizeClassAllocations[i]);
+			}
+		}
+	}));
@@ -1,5 +1,8 @@
 #include "CoroStateMachine/CoroStateMachine.h"
 
+#include "CoreGlobals.h"
+#include "Misc/App.h"
+
 void CoroStateMachine::Destroy()
 {
 	Reset();
@@ -13,60 +16,193 @@ void CoroStateMachine::ChangeToState(const CoroState& NewState)
 		OnExitFunc();
 	}
 	Reset();
-	CurrentTask = NewState.Handle;
 	CurrentState = NewState;
 }
 
 void CoroStateMachine::Reset()
 {
+	//Wake first, the awaiters being waited on live in the frames we're about to free.
+	Wake();
 	FreeEntireCoroutineStack();
-	CurrentStateTransitions.clear();
-	CurrentStatelessTasks.clear();
+	for (int32 i = 0; i < NumTransitions; ++i)
+	{
+		Transitions[i] = TransitionBundle{};
+	}
+	NumTransitions = 0;
+	NextTransition = 0;
+	NumUnwatchedTransitions = 0;
+	//Everything is dirty for a fresh state, its transitions haven't seen any input yet.
+	DirtyInputs = ~0u;
+	for (int32 i = 0; i < NumStatelessTasks; ++i)
+	{
+		StatelessTasks[i] = nullptr;
+	}
+	NumStatelessTasks = 0;
 	NextState = nullptr;
 	OnExitFunc = nullptr;
-	CurrentTask = nullptr;
 	Sleeping = false;
 }
 
 void CoroStateMachine::FreeEntireCoroutineStack()
 {
-	while (!CoroutineStack.empty())
+	while (TaskTop)
 	{
-		if (auto Top = CoroutineStack.top())
+		const auto Parent = TaskTop->ParentTask;
+		TaskTop->Self.destroy();
+		TaskTop = Parent;
+	}
+
+	//The state frame has to be freed too or it never makes it back to the frame pool.
+	if (CurrentState.Handle)
+	{
+		CurrentState.Handle.destroy();
+		CurrentState.Handle = nullptr;
+	}
+}
+
+void CoroStateMachine::AwaitPush(CoroTaskPromiseBase& Promise)
+{
+	Promise.ParentTask = TaskTop;
+	Promise.StackTop = &TaskTop;
+	TaskTop = &Promise;
+}
+
+const TransitionBundle* CoroStateMachine::CheckNextTransition()
+{
+	if (NumTransitions == 0)
+	{
+		return nullptr;
+	}
+
+	if (TransitionEvaluation == ECoroTransitionEvaluation::Priority)
+	{
+		return CheckTransitionsByPriority();
+	}
+
+	const auto& Bundle = Transitions[NextTransition];
+	if (Bundle.TransFunc())
+	{
+		return &Bundle;
+	}
+
+	//Advance the cursor so the transition we just evaluated is now the back of the ring.
+	NextTransition = (NextTransition + 1) % NumTransitions;
+
+	return nullptr;
+}
+
+const TransitionBundle* CoroStateMachine::CheckTransitionsByPriority()
+{
+	const auto Dirty = DirtyInputs;
+	DirtyInputs = 0;
+
+	//Common case, nothing changed and every transition is watching something.
+	if (Dirty == 0 && NumUnwatchedTransitions == 0)
+	{
+		return nullptr;
+	}
+
+	//The ring is kept sorted by descending priority, so the first passing transition wins.
+	for (int32 i = 0; i < NumTransitions; ++i)
+	{
+		const auto& Bundle = Transitions[i];
+		if (Bundle.WatchMask != 0 && (Bundle.WatchMask & Dirty) == 0)
+		{
+			continue;
+		}
+		if (Bundle.TransFunc())
 		{
-			Top.destroy();
+			return &Bundle;
 		}
-		CoroutineStack.pop();
 	}
+
+	return nullptr;
+}
+
+void CoroStateMachine::SetSleepHost(CoroSleepHost* InSleepHost)
+{
+	//Timers are scheduled against the old host's clock, so anything pending finishes early rather than never.
+	Wake();
+	SleepHost = InSleepHost;
 }
 
-void CoroStateMachine::AwaitPush(const coroutine_handle<> NewHandle)
+void CoroStateMachine::SuspendForSeconds(const float Seconds)
 {
-	if (CurrentTask)
+	WaitKind = ECoroWaitKind::Seconds;
+	if (SleepHost)
 	{
-		CoroutineStack.push(CurrentTask);
+		SleepHost->ScheduleSeconds(WakeTimer, Seconds);
+		SleepHost->OnMachineSuspended(*this);
+	}
+	else
+	{
+		FallbackWakeTime = FApp::GetCurrentTime() + Seconds;
 	}
-	CurrentTask = NewHandle;
 }
 
-std::function<CoroState()> CoroStateMachine::CheckNextTransition()
+void CoroStateMachine::SuspendForFrames(const uint32 Frames)
 {
-	if (CurrentStateTransitions.empty())
+	WaitKind = ECoroWaitKind::Frames;
+	if (SleepHost)
 	{
-		return nullptr;
+		SleepHost->ScheduleFrames(WakeTimer, Frames);
+		SleepHost->OnMachineSuspended(*this);
+	}
+	else
+	{
+		FallbackWakeFrame = GFrameCounter + Frames;
+	}
+}
+
+void CoroStateMachine::SuspendForEvent(CoroEvent& Event)
+{
+	WaitKind = ECoroWaitKind::Event;
+	Event.AddWaiter(EventWaiter);
+	if (SleepHost)
+	{
+		SleepHost->OnMachineSuspended(*this);
 	}
+}
 
-	auto& [TransFunc, StateFunc] = CurrentStateTransitions.front();
-	if (TransFunc())
+void CoroStateMachine::CancelWait()
+{
+	if (SleepHost)
 	{
-		return StateFunc;
+		SleepHost->CancelTimer(WakeTimer);
 	}
+	EventWaiter.Cancel();
+	WaitKind = ECoroWaitKind::None;
+}
 
-	//Rotate our deque so the transition we just evaluated is now the back.
-	CurrentStateTransitions.push_back(CurrentStateTransitions.front());
-	CurrentStateTransitions.pop_front();
+void CoroStateMachine::Wake()
+{
+	if (!IsWaiting())
+	{
+		return;
+	}
+	CancelWait();
+	if (SleepHost)
+	{
+		SleepHost->OnMachineWoken(*this);
+	}
+}
 
-	return nullptr;
+void CoroStateMachine::OnWakeTimer(CoroTimerNode& Node)
+{
+	static_cast<CoroStateMachine*>(Node.Owner)->Wake();
+}
+
+bool CoroStateMachine::PollWait()
+{
+	if (!SleepHost)
+	{
+		if ((WaitKind == ECoroWaitKind::Seconds && FApp::GetCurrentTime() >= FallbackWakeTime) ||
+			(WaitKind == ECoroWaitKind::Frames && GFrameCounter >= FallbackWakeFrame))
+		{
+			CancelWait();
+		}
+	}
+	return IsWaiting();
 }
 
 bool CoroStateMachine::Run()
@@ -80,77 +216,104 @@ bool CoroStateMachine::Run()
 		if (NextState)
 		{
 			//We have a valid next state, so we move to that.
-			ChangeToState(std::move(NextState()));
+			ChangeToState(NextState());
 			return true;
 		}
 		return false;
 	}
 
-	for (const auto& StatelessTask : CurrentStatelessTasks)
+	for (int32 i = 0; i < NumStatelessTasks; ++i)
 	{
-		StatelessTask();
+		StatelessTasks[i]();
 	}
 
 	//Check trasition, if we should transition run any exit code and switch states.
-	if (const auto CheckResult = CheckNextTransition())
+	if (const auto Transition = CheckNextTransition())
 	{
-		ChangeToState(CheckResult());
+		ChangeToState(Transition->StateFunc());
 	}
 
-	//If we have no valid task or the current one is done, pop the stack until we have a valid task or return false.
-	while (!CurrentTask || CurrentTask.done())
+	//Finished tasks pop themselves and hand control straight back to their caller, so the top is always live.
+	if (!TaskTop && (!CurrentState.Handle || CurrentState.Handle.done()))
 	{
-		if (CoroutineStack.empty())
-		{
-			if (NextState)
-			{
-				//We have a valid next state, so we move to that.
-				ChangeToState(std::move(NextState()));
-				return true;
-			}
-
-			//CurrentState.ExitAndDestroy();
-			return false;
-		}
-		if (CurrentTask)
+		if (NextState)
 		{
-			CurrentTask.destroy();
+			//We have a valid next state, so we move to that.
+			ChangeToState(NextState());
+			return true;
 		}
-		CurrentTask = CoroutineStack.top();
-		CoroutineStack.pop();
+
+		return false;
+	}
+
+	if (IsWaiting() && PollWait())
+	{
+		return true;
 	}
 
-	CurrentTask.resume();
+	if (TaskTop)
+	{
+		TaskTop->Self.resume();
+	}
+	else
+	{
+		CurrentState.Handle.resume();
+	}
 	return true;
 }
 
-CoroStateMachine& CoroStateMachine::AddTransition(
-	const std::function<bool()>& TransitionFunc, const std::function<CoroState()>& StateConstructor)
+CoroStateMachine& CoroStateMachine::AddTransition(CoroTransitionFunc TransitionFunc, CoroStateFunc StateConstructor,
+                                                  const int32 Priority, const uint32 WatchMask)
 {
-	CurrentStateTransitions.push_back(TransitionBundle{TransitionFunc, StateConstructor});
+	check(NumTransitions < MaxTransitions);
+
+	//Insertion sort, equal priorities keep the order they were added in.
+	int32 Slot = NumTransitions;
+	while (Slot > 0 && Transitions[Slot - 1].Priority < Priority)
+	{
+		Transitions[Slot] = std::move(Transitions[Slot - 1]);
+		--Slot;
+	}
+	Transitions[Slot] = TransitionBundle{std::move(TransitionFunc), std::move(StateConstructor), Priority, WatchMask};
+	++NumTransitions;
+
+	if (WatchMask == 0)
+	{
+		++NumUnwatchedTransitions;
+	}
 	return *this;
 }
 
-CoroStateMachine& CoroStateMachine::ContinueWith(
-	const std::function<CoroState()>& StateConstructor)
+CoroStateMachine& CoroStateMachine::ContinueWith(CoroStateFunc StateConstructor)
 {
-	NextState = StateConstructor;
+	NextState = std::move(StateConstructor);
 	return *this;
 }
 
-CoroStateMachine& CoroStateMachine::OnExit(const std::function<void()>& Finalizer)
+CoroStateMachine& CoroStateMachine::OnExit(CoroActionFunc Finalizer)
 {
-	OnExitFunc = Finalizer;
+	OnExitFunc = std::move(Finalizer);
 	return *this;
 }
 
-TaskAwaiter CoroStateMachine::WaitForTask(CoroTask&& TaskToAwait)
+WaitAwaiter CoroStateMachine::WaitSeconds(const float Seconds)
+{
+	return WaitAwaiter{*this, ECoroWaitKind::Seconds, Seconds};
+}
+
+WaitAwaiter CoroStateMachine::WaitFrames(const uint32 Frames)
+{
+	return WaitAwaiter{*this, ECoroWaitKind::Frames, 0.0f, Frames};
+}
+
+WaitAwaiter CoroStateMachine::WaitUntilSignaled(CoroEvent& Event)
 {
-	return TaskAwaiter{*this, std::forward<CoroTask>(TaskToAwait)};
+	return WaitAwaiter{*this, ECoroWaitKind::Event, 0.0f, 0, &Event};
 }
 
-CoroStateMachine& CoroStateMachine::AddStatelessTask(const std::function<void()>& Task)
+CoroStateMachine& CoroStateMachine::AddStatelessTask(CoroActionFunc Task)
 {
-	CurrentStatelessTasks.push_back(std::move(Task));
+	check(NumStatelessTasks < MaxStatelessTasks);
+	StatelessTasks[NumStatelessTasks++] = std::move(Task);
 	return *this;
 }
@@ -0,0 +1,160 @@
+#include "CoroStateMachine/CoroTimerWheel.h"
+
+CoroTimerWheel::CoroTimerWheel()
+{
+	for (auto& Level : Slots)
+	{
+		for (auto& Sentinel : Level)
+		{
+			Sentinel.Next = &Sentinel;
+			Sentinel.Prev = &Sentinel;
+		}
+	}
+}
+
+void CoroTimerWheel::Link(CoroTimerNode& Sentinel, CoroTimerNode& Node)
+{
+	Node.Prev = Sentinel.Prev;
+	Node.Next = &Sentinel;
+	Sentinel.Prev->Next = &Node;
+	Sentinel.Prev = &Node;
+}
+
+void CoroTimerWheel::Unlink(CoroTimerNode& Node)
+{
+	Node.Prev->Next = Node.Next;
+	Node.Next->Prev = Node.Prev;
+	Node.Next = nullptr;
+	Node.Prev = nullptr;
+}
+
+void CoroTimerWheel::Schedule(CoroTimerNode& Node, const uint64 DelayTicks)
+{
+	//Rescheduling may move the node over from another wheel.
+	if (Node.Wheel)
+	{
+		Node.Wheel->Cancel(Node);
+	}
+	Node.Deadline = Now + FMath::Clamp<uint64>(DelayTicks, 1, MaxDelay);
+	Node.Wheel = this;
+	Insert(Node);
+	++NumScheduled;
+}
+
+void CoroTimerWheel::Cancel(CoroTimerNode& Node)
+{
+	if (Node.IsScheduled() && Node.Wheel == this)
+	{
+		Unlink(Node);
+		Node.Wheel = nullptr;
+		--NumScheduled;
+		check(NumScheduled >= 0);
+	}
+}
+
+void CoroTimerWheel::Insert(CoroTimerNode& Node)
+{
+	const uint64 Delta = Node.Deadline > Now ? Node.Deadline - Now : 0;
+
+	int32 Level = 0;
+	while (Level < NumLevels - 1 && Delta >= (1ull << (SlotBits * (Level + 1))))
+	{
+		++Level;
+	}
+
+	//Slots are picked from the absolute deadline so a level is cascaded exactly when its slot comes due.
+	const auto PlacementDeadline = FMath::Min(Node.Deadline, Now + MaxDelay);
+	const auto Slot = (PlacementDeadline >> (SlotBits * Level)) & SlotMask;
+	Link(Slots[Level][Slot], Node);
+}
+
+void CoroTimerWheel::Cascade(const int32 Level, const uint64 Slot)
+{
+	auto& Sentinel = Slots[Level][Slot];
+	while (Sentinel.Next != &Sentinel)
+	{
+		auto& Node = *Sentinel.Next;
+		Unlink(Node);
+		Insert(Node);
+	}
+}
+
+void CoroTimerWheel::Advance(const uint64 Ticks)
+{
+	for (uint64 i = 0; i < Ticks; ++i)
+	{
+		if (NumScheduled == 0)
+		{
+			//Nothing to fire, skip the rest of the walk.
+			Now += Ticks - i;
+			return;
+		}
+
+		++Now;
+		for (int32 Level = 1; Level < NumLevels; ++Level)
+		{
+			if ((Now & ((1ull << (SlotBits * Level)) - 1)) != 0)
+			{
+				break;
+			}
+			Cascade(Level, (Now >> (SlotBits * Level)) & SlotMask);
+		}
+
+		//Detach the due slot first, callbacks are free to schedule again.
+		CoroTimerNode Due;
+		Due.Next = &Due;
+		Due.Prev = &Due;
+		auto& Sentinel = Slots[0][Now & SlotMask];
+		while (Sentinel.Next != &Sentinel)
+		{
+			auto& Node = *Sentinel.Next;
+			Unlink(Node);
+			Link(Due, Node);
+		}
+
+		while (Due.Next != &Due)
+		{
+			auto& Node = *Due.Next;
+			Unlink(Node);
+			Node.Wheel = nullptr;
+			--NumScheduled;
+			check(NumScheduled >= 0);
+			if (Node.Callback)
+			{
+				Node.Callback(Node);
+			}
+		}
+	}
+}
+
+void CoroSleepHost::Advance(const double DeltaSeconds)
+{
+	PendingTicks += DeltaSeconds * TicksPerSecond;
+	const auto WholeTicks = FMath::FloorToDouble(PendingTicks);
+	PendingTicks -= WholeTicks;
+
+	FScopeLock Lock(&TimerLock);
+	SecondsWheel.Advance(static_cast<uint64>(WholeTicks));
+	FramesWheel.Advance(1);
+}
+
+void CoroSleepHost::ScheduleSeconds(CoroTimerNode& Node, const double Seconds)
+{
+	FScopeLock Lock(&TimerLock);
+	SecondsWheel.Schedule(Node, static_cast<uint64>(FMath::CeilToDouble(Seconds * TicksPerSecond)));
+}
+
+void CoroSleepHost::ScheduleFrames(CoroTimerNode& Node, const uint32 Frames)
+{
+	FScopeLock Lock(&TimerLock);
+	FramesWheel.Schedule(Node, Frames);
+}
+
+void CoroSleepHost::CancelTimer(CoroTimerNode& Node)
+{
+	FScopeLock Lock(&TimerLock);
+	if (Node.Wheel)
+	{
+		Node.Wheel->Cancel(Node);
+	}
+}
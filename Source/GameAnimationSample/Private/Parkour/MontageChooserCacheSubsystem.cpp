@@ -0,0 +1,228 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Parkour/MontageChooserCacheSubsystem.h"
+
+#include "Chooser.h"
+#include "Animation/AnimMontage.h"
+#include "Engine/World.h"
+#include "HAL/IConsoleManager.h"
+
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Montage Cache Hits"), STAT_MontageCacheHits, STATGROUP_Parkour);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Montage Cache Misses"), STAT_MontageCacheMisses, STATGROUP_Parkour);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Montage Cache Entries"), STAT_MontageCacheEntries, STATGROUP_Parkour);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Montage Warp Table Entries"), STAT_MontageWarpTableEntries, STATGROUP_Parkour);
+
+static TAutoConsoleVariable<bool> CVarMontageCacheEnabled(
+	TEXT("Parkour.MontageCache.Enabled"),
+	true,
+	TEXT("Reuse the traversal chooser's candidates for chooser params that land in the same buckets."));
+
+static TAutoConsoleVariable<float> CVarMontageCacheHeightQuantum(
+	TEXT("Parkour.MontageCache.HeightQuantum"),
+	5.0f,
+	TEXT("Size in cm of the obstacle height buckets."));
+
+static TAutoConsoleVariable<float> CVarMontageCacheDepthQuantum(
+	TEXT("Parkour.MontageCache.DepthQuantum"),
+	5.0f,
+	TEXT("Size in cm of the obstacle depth buckets."));
+
+static TAutoConsoleVariable<float> CVarMontageCacheSpeedQuantum(
+	TEXT("Parkour.MontageCache.SpeedQuantum"),
+	25.0f,
+	TEXT("Size in cm/s of the speed buckets."));
+
+static TAutoConsoleVariable<int32> CVarMontageCacheMaxEntries(
+	TEXT("Parkour.MontageCache.MaxEntries"),
+	1024,
+	TEXT("The cache is flushed once it grows past this many entries."));
+
+void UMontageChooserCacheSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+#if WITH_EDITOR
+	ObjectPropertyChangedHandle = FCoreUObjectDelegates::OnObjectPropertyChanged.AddUObject(
+		this, &UMontageChooserCacheSubsystem::OnObjectPropertyChanged);
+#endif
+}
+
+void UMontageChooserCacheSubsystem::Deinitialize()
+{
+#if WITH_EDITOR
+	FCoreUObjectDelegates::OnObjectPropertyChanged.Remove(ObjectPropertyChangedHandle);
+#endif
+	ResetCache();
+	Super::Deinitialize();
+}
+
+FMontageChooserCacheKey UMontageChooserCacheSubsystem::MakeKey(const UChooserTable* Chooser,
+                                                               const FMovementChooserParams& Params)
+{
+	const float HeightQuantum = FMath::Max(1.0f, CVarMontageCacheHeightQuantum.GetValueOnGameThread());
+	const float DepthQuantum = FMath::Max(1.0f, CVarMontageCacheDepthQuantum.GetValueOnGameThread());
+	const float SpeedQuantum = FMath::Max(1.0f, CVarMontageCacheSpeedQuantum.GetValueOnGameThread());
+
+	FMontageChooserCacheKey Key;
+	Key.Chooser = Chooser;
+	Key.Gait = Params.Gait;
+	Key.ParkourAction = Params.ParkourAction;
+	Key.HeightBucket = FMath::RoundToInt32(Params.ObstacleHeight / HeightQuantum);
+	Key.DepthBucket = FMath::RoundToInt32(Params.ObstacleDepth / DepthQuantum);
+	Key.SpeedBucket = FMath::RoundToInt32(Params.Speed / SpeedQuantum);
+	return Key;
+}
+
+void UMontageChooserCacheSubsystem::GetCandidates(const UChooserTable* Chooser, const FMovementChooserParams& Params,
+                                                  TArray<UObject*>& OutCandidates)
+{
+	OutCandidates.Reset();
+	if (!CVarMontageCacheEnabled.GetValueOnGameThread())
+	{
+		EvaluateChooser(Chooser, Params, OutCandidates);
+		return;
+	}
+
+	const auto Key = MakeKey(Chooser, Params);
+	if (const auto Cached = Cache.Find(Key))
+	{
+		//A candidate that went away means the chooser was reloaded, evaluate it again.
+		bool bAllValid = true;
+		for (const auto& Candidate : *Cached)
+		{
+			const auto Object = Candidate.Get();
+			bAllValid &= Object != nullptr;
+			OutCandidates.Add(Object);
+		}
+		if (bAllValid)
+		{
+			++Stats.Hits;
+			INC_DWORD_STAT(STAT_MontageCacheHits);
+			return;
+		}
+		OutCandidates.Reset();
+	}
+
+	++Stats.Misses;
+	INC_DWORD_STAT(STAT_MontageCacheMisses);
+	//The caller's own params, snapping them could cross a row's range and pick different montages than the uncached
+	//path. The quanta are meant to stay well inside the chooser's row ranges.
+	EvaluateChooser(Chooser, Params, OutCandidates);
+
+	for (const auto Candidate : OutCandidates)
+	{
+		if (const auto Montage = Cast<UAnimMontage>(Candidate))
+		{
+			WarpTable.FindOrAdd(Montage);
+		}
+	}
+	SET_DWORD_STAT(STAT_MontageWarpTableEntries, WarpTable.Num());
+
+	if (Cache.Num() >= CVarMontageCacheMaxEntries.GetValueOnGameThread())
+	{
+		Cache.Reset();
+	}
+	Cache.Add(Key, TArray<TWeakObjectPtr<UObject>>(OutCandidates));
+	SET_DWORD_STAT(STAT_MontageCacheEntries, Cache.Num());
+}
+
+void UMontageChooserCacheSubsystem::EvaluateChooser(const UChooserTable* Chooser,
+                                                    const FMovementChooserParams& Params,
+                                                    TArray<UObject*>& OutCandidates)
+{
+	//The chooser reads the params through the context, a copy keeps the caller's const.
+	auto ChooserParams = Params;
+	FChooserEvaluationContext EvalCTX{};
+	EvalCTX.AddStructParam(ChooserParams);
+
+	UChooserTable::EvaluateChooser(EvalCTX, Chooser,
+	                               FObjectChooserBase::FObjectChooserIteratorCallback::CreateLambda(
+		                               [&OutCandidates](UObject* InResult)
+		                               {
+			                               if (InResult == nullptr)
+			                               {
+				                               return FObjectChooserBase::EIteratorStatus::Stop;
+			                               }
+			                               OutCandidates.Add(InResult);
+			                               return FObjectChooserBase::EIteratorStatus::Continue;
+		                               }));
+}
+
+const FTraversalWarpMetadata& UMontageChooserCacheSubsystem::FindOrBakeWarpMetadata(const UAnimMontage* Montage)
+{
+	const auto& Metadata = WarpTable.FindOrAdd(Montage);
+	SET_DWORD_STAT(STAT_MontageWarpTableEntries, WarpTable.Num());
+	return Metadata;
+}
+
+void UMontageChooserCacheSubsystem::RecordSelection(const double Milliseconds)
+{
+	++Stats.Selections;
+	Stats.SelectionMs += Milliseconds;
+}
+
+FMontageChooserCacheStats UMontageChooserCacheSubsystem::GetStats() const
+{
+	return Stats;
+}
+
+void UMontageChooserCacheSubsystem::ResetCache()
+{
+	Cache.Reset();
+	WarpTable.Reset();
+	Stats = FMontageChooserCacheStats{};
+	SET_DWORD_STAT(STAT_MontageCacheEntries, 0);
+	SET_DWORD_STAT(STAT_MontageWarpTableEntries, 0);
+}
+
+#if WITH_EDITOR
+void UMontageChooserCacheSubsystem::OnObjectPropertyChanged(UObject* Object,
+                                                            FPropertyChangedEvent& PropertyChangedEvent)
+{
+	//Rows and nested choosers live inside the root chooser asset, any edit to it may change every bucket.
+	if (Object && (Object->IsA<UChooserTable>() || Object->GetTypedOuter<UChooserTable>()))
+	{
+		Cache.Reset();
+		SET_DWORD_STAT(STAT_MontageCacheEntries, 0);
+	}
+	//Moving a warp notify or editing the curve only invalidates that montage.
+	else if (Object)
+	{
+		auto Montage = Cast<UAnimMontage>(Object);
+		Montage = Montage ? Montage : Object->GetTypedOuter<UAnimMontage>();
+		if (Montage)
+		{
+			WarpTable.Remove(Montage);
+			SET_DWORD_STAT(STAT_MontageWarpTableEntries, WarpTable.Num());
+		}
+	}
+}
+#endif
+
+bool UMontageChooserCacheSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+static FAutoConsoleCommandWithWorldAndArgs MontageCacheStatsCommand(
+	TEXT("Parkour.MontageCache.Stats"),
+	TEXT("Logs the traversal montage cache hit rate and selection time. Usage: Parkour.MontageCache.Stats [Reset]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		const auto MontageCache = World ? World->GetSubsystem<UMontageChooserCacheSubsystem>() : nullptr;
+		if (!MontageCache)
+		{
+			return;
+		}
+
+		const auto Stats = MontageCache->GetStats();
+		UE_LOG(LogTemp, Log,
+		       TEXT("Montage cache: %d entries, %d warp entries, %llu hits, %llu misses, %.1f%% hit rate. %llu selections, %.3f ms average"),
+		       MontageCache->GetNumEntries(), MontageCache->GetNumWarpEntries(), Stats.Hits, Stats.Misses, Stats.GetHitRate() * 100.0, Stats.Selections,
+		       Stats.GetAverageSelectionMs());
+
+		if (Args.Num() > 0 && Args[0] == TEXT("Reset"))
+		{
+			MontageCache->ResetCache();
+		}
+	}));
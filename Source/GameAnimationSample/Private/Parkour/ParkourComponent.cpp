@@ -1,18 +1,65 @@
 #include "Parkour/ParkourComponent.h"
 
-#include "AnimationWarpingLibrary.h"
 #include "Chooser.h"
 #include "InputActionValue.h"
-#include "KismetTraceUtils.h"
 #include "MotionWarpingComponent.h"
+#include "TimerManager.h"
+#include "AssetRegistry/IAssetRegistry.h"
 #include "Components/CapsuleComponent.h"
+#include "Engine/AssetManager.h"
+#include "Engine/StreamableManager.h"
 #include "GameFramework/Character.h"
 #include "GameFramework/CharacterMovementComponent.h"
 #include "Input/EnhancedPlayerInputComponent.h"
+#include "HAL/PlatformTime.h"
 #include "Logging/StructuredLog.h"
+#include "Parkour/MontageChooserCacheSubsystem.h"
+#include "Parkour/TraversalQuerySubsystem.h"
+#include "PoseSearch/PoseSearchDatabase.h"
 #include "PoseSearch/PoseSearchLibrary.h"
+#include "Scheduling/CoroSchedulerSubsystem.h"
 #include "Traversables/TraversableActor.h"
 
+#if WITH_EDITOR
+#include "PoseSearch/PoseSearchDerivedData.h"
+#endif
+
+DECLARE_CYCLE_STAT(TEXT("Traversal Check"), STAT_ParkourTraversalCheck, STATGROUP_Parkour);
+DECLARE_CYCLE_STAT(TEXT("Montage Selection"), STAT_ParkourMontageSelection, STATGROUP_Parkour);
+DECLARE_CYCLE_STAT(TEXT("Montage Search (Async)"), STAT_ParkourMontageSearch, STATGROUP_Parkour);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Montage Search Fallbacks"), STAT_ParkourMontageSearchFallbacks, STATGROUP_Parkour);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Speculative Hits"), STAT_ParkourSpeculativeHits, STATGROUP_Parkour);
+DECLARE_DWORD_ACCUMULATOR_STAT(TEXT("Speculative Misses"), STAT_ParkourSpeculativeMisses, STATGROUP_Parkour);
+
+void FParkourMontageSearchFence::ExecuteTick(const float DeltaTime, ELevelTick TickType,
+                                             ENamedThreads::Type CurrentThread,
+                                             const FGraphEventRef& MyCompletionGraphEvent)
+{
+	if (Component)
+	{
+		Component->WaitForMontageSearch();
+	}
+}
+
+FString FParkourMontageSearchFence::DiagnosticMessage()
+{
+	return TEXT("FParkourMontageSearchFence");
+}
+
+void FParkourMontageSearchLaunch::ExecuteTick(const float DeltaTime, ELevelTick TickType,
+                                              ENamedThreads::Type CurrentThread,
+                                              const FGraphEventRef& MyCompletionGraphEvent)
+{
+	if (Component)
+	{
+		Component->LaunchPendingMontageSearch();
+	}
+}
+
+FString FParkourMontageSearchLaunch::DiagnosticMessage()
+{
+	return TEXT("FParkourMontageSearchLaunch");
+}
 
 UParkourComponent::UParkourComponent()
 {
@@ -30,6 +77,7 @@ void UParkourComponent::GetDesiredGait(const FVector StickMovementInput)
 	{
 		CurrentDesiredGait = EMovementGait::Walk;
 	}
+	ParkourInputEvent.Signal();
 }
 
 void UParkourComponent::UpdateRotation(const bool WantsToStrafe)
@@ -89,6 +137,7 @@ void UParkourComponent::Move(const FInputActionValue& InputActionValue)
 
 	ControlledCharacter->AddMovementInput(ForwardDirection, InputAxisVector.Y);
 	ControlledCharacter->AddMovementInput(RightDirection, InputAxisVector.X);
+	ParkourInputEvent.Signal();
 }
 
 void UParkourComponent::Look(const FInputActionValue& InputActionValue)
@@ -109,12 +158,14 @@ void UParkourComponent::LookGamepad(const FInputActionValue& InputActionValue)
 void UParkourComponent::WalkToggle(const FInputActionValue& InputActionValue)
 {
 	bWantsToWalk = (!bWantsToSprint) && (!bWantsToWalk);
+	ParkourInputEvent.Signal();
 }
 
 void UParkourComponent::Sprint(const FInputActionValue& InputActionValue)
 {
 	bWantsToSprint = InputActionValue.Get<bool>();
 	bWantsToWalk = false;
+	ParkourInputEvent.Signal();
 }
 
 float UParkourComponent::GetForwardTraversalTraceDistance(const FVector& CurrentVelocity,
@@ -124,61 +175,42 @@ float UParkourComponent::GetForwardTraversalTraceDistance(const FVector& Current
 	return FMath::GetMappedRangeValueClamped(VelocityRange, TraceRange, ForwardVelocity);
 }
 
-bool ParkourTrace(
-	FHitResult& OutHit,
-	const UWorld* World,
+FTraceHandle AsyncParkourTrace(
+	UWorld* World,
 	const FCollisionQueryParams& CapsuleTraceParams,
 	const FCollisionShape& TraceCapsule,
 	const FQuat& CapsuleRotation,
 	const FVector& TraceStart,
-	const FVector& TraceEnd,
-	const bool bDrawDebug,
-	const FColor DebugColor,
-	const float DebugDuration)
+	const FVector& TraceEnd)
 {
-	World->SweepSingleByChannel(OutHit,
-	                            TraceStart,
-	                            TraceEnd,
-	                            CapsuleRotation,
-	                            ECC_Visibility,
-	                            TraceCapsule,
-	                            CapsuleTraceParams);
-
-	if (bDrawDebug)
-	{
-		DrawDebugCapsuleTraceSingle(
-			World,
-			TraceStart,
-			TraceEnd,
-			TraceCapsule.GetCapsuleRadius(),
-			TraceCapsule.GetCapsuleHalfHeight(),
-			EDrawDebugTrace::ForDuration, OutHit.bBlockingHit, FHitResult{}, DebugColor, DebugColor, DebugDuration);
-	}
-
-	return OutHit.bBlockingHit;
+	return World->AsyncSweepByChannel(EAsyncTraceType::Single,
+	                                  TraceStart,
+	                                  TraceEnd,
+	                                  CapsuleRotation,
+	                                  ECC_Visibility,
+	                                  TraceCapsule,
+	                                  CapsuleTraceParams);
 }
 
-bool GetAnimationDistanceFromFrontLedgeToTargetOrDeleteWarp(
-	const UAnimMontage* Anim,
-	UMotionWarpingComponent* const MotionWarpingComponent,
-	const FName& WarpingTerminalZoneName,
-	const FName& DistanceFromLedgeName, float& OutAnimationDistance)
+enum class EAsyncParkourTraceStatus : uint8
+{
+	Pending,
+	Finished,
+	Expired
+};
+
+//Async sweeps run at the end of the frame they're issued in, the results can only be read during the next frame.
+EAsyncParkourTraceStatus PollAsyncParkourTrace(UWorld* World, const FTraceHandle& Handle, FHitResult& OutHit)
 {
-	TArray<FMotionWarpingWindowData> BackLedgeMotionWarpingWindows;
-	UMotionWarpingUtilities::GetMotionWarpingWindowsForWarpTargetFromAnimation(
-		Anim, WarpingTerminalZoneName, BackLedgeMotionWarpingWindows);
-	if (!BackLedgeMotionWarpingWindows.IsEmpty())
+	FTraceDatum Datum;
+	if (World->QueryTraceData(Handle, Datum))
 	{
-		float AnimationDistanceFromXtoY;
-		UAnimationWarpingLibrary::GetCurveValueFromAnimation(Anim, DistanceFromLedgeName,
-		                                                     BackLedgeMotionWarpingWindows[0].EndTime,
-		                                                     AnimationDistanceFromXtoY);
-		OutAnimationDistance = AnimationDistanceFromXtoY;
-		return true;
+		OutHit = Datum.OutHits.IsEmpty() ? FHitResult{} : Datum.OutHits[0];
+		return EAsyncParkourTraceStatus::Finished;
 	}
-
-	MotionWarpingComponent->RemoveWarpTarget(WarpingTerminalZoneName);
-	return false;
+	return World->IsTraceHandleValid(Handle, false)
+		       ? EAsyncParkourTraceStatus::Pending
+		       : EAsyncParkourTraceStatus::Expired;
 }
 
 bool UParkourComponent::SelectParkourMontage(
@@ -187,6 +219,35 @@ bool UParkourComponent::SelectParkourMontage(
 	UAnimMontage*& OutAnim,
 	float& OutTime,
 	float& OutPlayRate) const
+{
+	SCOPE_CYCLE_COUNTER(STAT_ParkourMontageSelection);
+	const double SelectionStart = FPlatformTime::Seconds();
+
+	TArray<UObject*> Results;
+	GatherMontageCandidates(ActionType, TraversalCheck, Results);
+
+	FParkourMontageSelection Selection;
+	const bool bFound = SearchMontageCandidates(ControlledCharacter->GetMesh()->GetAnimInstance(), MoveTemp(Results),
+	                                            Selection);
+
+	if (const auto MontageCache = GetWorld()->GetSubsystem<UMontageChooserCacheSubsystem>())
+	{
+		MontageCache->RecordSelection((FPlatformTime::Seconds() - SelectionStart) * 1000.0);
+	}
+
+	if (!bFound) return false;
+
+	OutAnim = Selection.Anim;
+	OutTime = Selection.Time;
+	OutPlayRate = Selection.PlayRate;
+
+	return true;
+}
+
+void UParkourComponent::GatherMontageCandidates(
+	const EParkourActionType ActionType,
+	const FTraversableCheckResult& TraversalCheck,
+	TArray<UObject*>& OutCandidates) const
 {
 	auto ChooserParams = FMovementChooserParams{
 		CurrentDesiredGait,
@@ -197,34 +258,261 @@ bool UParkourComponent::SelectParkourMontage(
 	};
 	OnTryTraverse.Broadcast(ChooserParams);
 
-	FChooserEvaluationContext EvalCTX{};
-	EvalCTX.AddStructParam(ChooserParams);
+	//The pose search only looks at the chooser's candidates, which rarely change between similar traversals.
+	if (const auto MontageCache = GetWorld()->GetSubsystem<UMontageChooserCacheSubsystem>())
+	{
+		MontageCache->GetCandidates(TraversalAnimChooser, ChooserParams, OutCandidates);
+	}
+	else
+	{
+		UMontageChooserCacheSubsystem::EvaluateChooser(TraversalAnimChooser, ChooserParams, OutCandidates);
+	}
+}
 
-	TArray<UObject*> Results;
-	UChooserTable::EvaluateChooser(EvalCTX, TraversalAnimChooser,
-	                               FObjectChooserBase::FObjectChooserIteratorCallback::CreateLambda(
-		                               [&Results](UObject* InResult)
-		                               {
-			                               if (InResult == nullptr)
-			                               {
-				                               return FObjectChooserBase::EIteratorStatus::Stop;
-			                               }
-			                               Results.Add(InResult);
-			                               return FObjectChooserBase::EIteratorStatus::Continue;
-		                               }));
+bool UParkourComponent::SearchMontageCandidates(UAnimInstance* AnimInstance, TArray<UObject*> Candidates,
+                                                FParkourMontageSelection& OutSelection)
+{
+	FPoseSearchBlueprintResult PoseSearchResult;
+	UPoseSearchLibrary::MotionMatch(AnimInstance, MoveTemp(Candidates), FName(TEXT("PoseHistory")),
+	                                FPoseSearchFutureProperties{}, PoseSearchResult, 69420);
+
+	OutSelection.Anim = const_cast<UAnimMontage*>(Cast<UAnimMontage>(PoseSearchResult.SelectedAnimation.Get()));
+	OutSelection.Time = PoseSearchResult.SelectedTime;
+	OutSelection.PlayRate = PoseSearchResult.WantedPlayRate;
+	return OutSelection.Anim != nullptr;
+}
+
+void UParkourComponent::StartMontageSearch(const FTraversableCheckResult& TraversalCheck,
+                                           const EParkourActionType ActionType)
+{
+	check(IsInGameThread());
+	WaitForMontageSearch();
 
+	//The chooser and its cache stay on the game thread, only the pose search goes to the worker.
+	TArray<UObject*> Candidates;
+	GatherMontageCandidates(ActionType, TraversalCheck, Candidates);
+
+	//The mesh has just updated, the fence keeps the next update from touching the pose history until the search is
+	//done with it.
 	const auto AnimInstance = ControlledCharacter->GetMesh()->GetAnimInstance();
-	FPoseSearchBlueprintResult PoseSearchResult;
-	UPoseSearchLibrary::MotionMatch(AnimInstance, Results, FName(TEXT("PoseHistory")), FPoseSearchFutureProperties{},
-	                                PoseSearchResult, 69420);
+	MontageSearchStartTime = FPlatformTime::Seconds();
+	bMontageSearchExpired = false;
+	MontageSearch = UE::Tasks::Launch(UE_SOURCE_LOCATION, [AnimInstance, Candidates = MoveTemp(Candidates)]() mutable
+	{
+		SCOPE_CYCLE_COUNTER(STAT_ParkourMontageSearch);
+		FParkourMontageSelection Selection;
+		if (!SearchMontageCandidates(AnimInstance, MoveTemp(Candidates), Selection))
+		{
+			return TOptional<FParkourMontageSelection>{};
+		}
+		return TOptional<FParkourMontageSelection>{Selection};
+	});
+}
 
-	OutAnim = const_cast<UAnimMontage*>(Cast<UAnimMontage>(PoseSearchResult.SelectedAnimation.Get()));
-	if (!OutAnim) return false;
+CoroTask<TOptional<FParkourMontageSelection>> UParkourComponent::MontageSelectionTask(
+	const EParkourActionType ActionType)
+{
+	//The search is queued when the commands are applied after this run and launched once the mesh has updated.
+	co_await std::suspend_always{};
 
-	OutTime = PoseSearchResult.SelectedTime;
-	OutPlayRate = PoseSearchResult.WantedPlayRate;
+	const auto Fallback = FallbackTraversalMontages.FindRef(ActionType);
+	while (bMontageSearchPending || (MontageSearch.IsValid() && !MontageSearch.IsCompleted()))
+	{
+		if (Fallback && !bMontageSearchPending &&
+			FPlatformTime::Seconds() >= MontageSearchStartTime + MontageSelectionDeadline)
+		{
+			break;
+		}
+		co_await std::suspend_always{};
+	}
 
-	return true;
+	if (!MontageSearch.IsValid())
+	{
+		co_return TOptional<FParkourMontageSelection>{};
+	}
+	//Still running, or the fence had to wait on it past the deadline, either way the traversal doesn't wait any longer.
+	if (Fallback && (bMontageSearchExpired || !MontageSearch.IsCompleted()))
+	{
+		INC_DWORD_STAT(STAT_ParkourMontageSearchFallbacks);
+		co_return FParkourMontageSelection{Fallback};
+	}
+	co_return MontageSearch.GetResult();
+}
+
+void UParkourComponent::LaunchPendingMontageSearch()
+{
+	if (!bMontageSearchPending)
+	{
+		return;
+	}
+	bMontageSearchPending = false;
+	StartMontageSearch(PendingMontageSearchCheck, PendingMontageSearchAction);
+}
+
+void UParkourComponent::WaitForMontageSearch()
+{
+	if (!MontageSearch.IsValid() || MontageSearch.IsCompleted())
+	{
+		return;
+	}
+
+	//MotionMatch reads the anim instance's live pose history, the mesh can't update until it's done.
+	MontageSearch.Wait();
+	bMontageSearchExpired = FPlatformTime::Seconds() >= MontageSearchStartTime + MontageSelectionDeadline;
+}
+
+void UParkourComponent::GatherTraversalAssets(const UChooserTable* Chooser, TArray<FSoftObjectPath>& OutAssets)
+{
+	const auto AssetRegistry = IAssetRegistry::Get();
+	if (!Chooser || !AssetRegistry)
+	{
+		return;
+	}
+
+	//Only choosers and databases lead to more traversal assets, a montage's own dependencies load with it. Cooked
+	//builds only have the dependencies because DefaultEngine.ini sets [AssetRegistry] bSerializeDependencies.
+	const int32 FirstAsset = OutAssets.Num();
+	TSet<FName> VisitedPackages;
+	TArray<FName> PendingPackages{Chooser->GetPackage()->GetFName()};
+	while (!PendingPackages.IsEmpty())
+	{
+		const auto PackageName = PendingPackages.Pop(EAllowShrinking::No);
+		bool bAlreadyVisited;
+		VisitedPackages.Add(PackageName, &bAlreadyVisited);
+		if (bAlreadyVisited)
+		{
+			continue;
+		}
+
+		TArray<FAssetData> PackageAssets;
+		AssetRegistry->GetAssetsByPackageName(PackageName, PackageAssets, true);
+		bool bFollowDependencies = false;
+		for (const auto& Asset : PackageAssets)
+		{
+			const bool bContainer = Asset.IsInstanceOf(UChooserTable::StaticClass()) ||
+				Asset.IsInstanceOf(UPoseSearchDatabase::StaticClass());
+			if (bContainer || Asset.IsInstanceOf(UAnimMontage::StaticClass()))
+			{
+				OutAssets.Add(Asset.GetSoftObjectPath());
+			}
+			bFollowDependencies |= bContainer;
+		}
+
+		if (bFollowDependencies)
+		{
+			TArray<FName> Dependencies;
+			AssetRegistry->GetDependencies(PackageName, Dependencies);
+			PendingPackages.Append(Dependencies);
+		}
+	}
+
+	//The chooser alone means its dependencies weren't found, the warm up has nothing to stream.
+	if (OutAssets.Num() - FirstAsset <= 1)
+	{
+		UE_LOG(LogTemp, Warning, TEXT("No traversal assets found behind chooser %s, are asset registry dependencies serialized?"),
+		       *Chooser->GetPathName());
+	}
+}
+
+void UParkourComponent::StartTraversalWarmUp()
+{
+	TraversalWarmUpStart = FPlatformTime::Seconds();
+	GatherTraversalAssets(TraversalAnimChooser, TraversalWarmUpAssets);
+	if (!bWarmUpTraversalAssets)
+	{
+		//Nothing is streamed in, the montages the chooser already holds are still baked now instead of on the first
+		//traversal.
+		BakeTraversalWarpMetadata();
+		TraversalWarmUpAssets.Reset();
+	}
+	if (TraversalWarmUpAssets.IsEmpty())
+	{
+		FinishTraversalWarmUp();
+		return;
+	}
+
+	TraversalWarmUpHandle = UAssetManager::GetStreamableManager().RequestAsyncLoad(
+		TraversalWarmUpAssets, FStreamableDelegate::CreateUObject(this, &ThisClass::OnTraversalAssetsLoaded),
+		FStreamableManager::AsyncLoadHighPriority);
+	if (!TraversalWarmUpHandle)
+	{
+		OnTraversalAssetsLoaded();
+	}
+}
+
+void UParkourComponent::BakeTraversalWarpMetadata()
+{
+	const auto MontageCache = GetWorld()->GetSubsystem<UMontageChooserCacheSubsystem>();
+	if (!MontageCache)
+	{
+		return;
+	}
+
+	//Only what's loaded, a montage that isn't is baked when the chooser first returns it.
+	for (const auto& AssetPath : TraversalWarmUpAssets)
+	{
+		if (const auto Montage = Cast<UAnimMontage>(AssetPath.ResolveObject()))
+		{
+			MontageCache->FindOrBakeWarpMetadata(Montage);
+		}
+	}
+}
+
+void UParkourComponent::OnTraversalAssetsLoaded()
+{
+	BakeTraversalWarpMetadata();
+	for (const auto& AssetPath : TraversalWarmUpAssets)
+	{
+		const auto Database = Cast<UPoseSearchDatabase>(AssetPath.ResolveObject());
+		if (Database && bPrebuildPoseSearchIndices)
+		{
+			PendingPoseSearchIndexBuilds.Add(Database);
+		}
+	}
+
+#if WITH_EDITOR
+	using namespace UE::PoseSearch;
+	for (const auto Database : PendingPoseSearchIndexBuilds)
+	{
+		FAsyncPoseSearchDatabasesManagement::RequestAsyncBuildIndex(Database, ERequestAsyncBuildFlag::NewRequest);
+	}
+	PollPoseSearchIndexBuilds();
+	if (!PendingPoseSearchIndexBuilds.IsEmpty())
+	{
+		GetWorld()->GetTimerManager().SetTimer(PoseSearchIndexBuildTimer, this,
+		                                       &ThisClass::PollPoseSearchIndexBuilds, 0.1f, true);
+	}
+#else
+	PendingPoseSearchIndexBuilds.Reset();
+	FinishTraversalWarmUp();
+#endif
+}
+
+void UParkourComponent::PollPoseSearchIndexBuilds()
+{
+#if WITH_EDITOR
+	using namespace UE::PoseSearch;
+	//A failed build is done too, the search will just skip that database like it would have anyway.
+	PendingPoseSearchIndexBuilds.RemoveAllSwap([](const UPoseSearchDatabase* Database)
+	{
+		return !Database || FAsyncPoseSearchDatabasesManagement::RequestAsyncBuildIndex(
+			Database, ERequestAsyncBuildFlag::ContinueRequest) != EAsyncBuildIndexResult::InProgress;
+	});
+#endif
+
+	if (PendingPoseSearchIndexBuilds.IsEmpty())
+	{
+		GetWorld()->GetTimerManager().ClearTimer(PoseSearchIndexBuildTimer);
+		FinishTraversalWarmUp();
+	}
+}
+
+void UParkourComponent::FinishTraversalWarmUp()
+{
+	bTraversalWarmUpFinished = true;
+	UE_LOGFMT(LogTemp, Log, "Traversal warm-up finished: {0} assets in {1} ms.", TraversalWarmUpAssets.Num(),
+	          (FPlatformTime::Seconds() - TraversalWarmUpStart) * 1000.0);
+	OnTraversalWarmUpFinished.Broadcast();
 }
 
 void UParkourComponent::UpdateMotionWarping(
@@ -235,7 +523,6 @@ void UParkourComponent::UpdateMotionWarping(
 	static const auto FrontLedgeName = FName(TEXT("FrontLedge"));
 	static const auto BackLedgeName = FName(TEXT("BackLedge"));
 	static const auto FloorName = FName(TEXT("BackFloor"));
-	static const auto DistanceFromLedgeName = FName(TEXT("Distance_From_Ledge"));
 
 	const auto MotionWarpingComponent = ControlledCharacter->GetComponentByClass<UMotionWarpingComponent>();
 
@@ -243,45 +530,37 @@ void UParkourComponent::UpdateMotionWarping(
 		FrontLedgeName, TraversalCheck.FrontLedgeLocation,
 		(-TraversalCheck.FrontLedgeNormal).ToOrientationRotator());
 
-	float AnimationWarpDistanceFromFrontLedgeToBackLedge{0.0};
-	if (not(ActionType == EParkourActionType::Hurdle || ActionType == EParkourActionType::Mantle))
+	//The windows and curve distances were baked when the montage first came out of the chooser.
+	const auto MontageCache = GetWorld()->GetSubsystem<UMontageChooserCacheSubsystem>();
+	const auto WarpMetadata = MontageCache
+		                          ? MontageCache->FindOrBakeWarpMetadata(Anim)
+		                          : FTraversalWarpTable::BakeMetadata(Anim);
+
+	if ((ActionType == EParkourActionType::Hurdle || ActionType == EParkourActionType::Mantle) &&
+		WarpMetadata.bHasBackLedgeWarp)
 	{
-		MotionWarpingComponent->RemoveWarpTarget(BackLedgeName);
+		MotionWarpingComponent->AddOrUpdateWarpTargetFromLocationAndRotation(
+			BackLedgeName, TraversalCheck.BackLedgeLocation, FRotator::ZeroRotator);
 	}
 	else
 	{
-		const bool bBackLedgeHadWarpTargets = GetAnimationDistanceFromFrontLedgeToTargetOrDeleteWarp(
-			Anim, MotionWarpingComponent, BackLedgeName, DistanceFromLedgeName,
-			AnimationWarpDistanceFromFrontLedgeToBackLedge);
-		if (bBackLedgeHadWarpTargets)
-		{
-			MotionWarpingComponent->AddOrUpdateWarpTargetFromLocationAndRotation(
-				BackLedgeName, TraversalCheck.BackLedgeLocation, FRotator::ZeroRotator);
-		}
+		MotionWarpingComponent->RemoveWarpTarget(BackLedgeName);
 	}
 
-	if (ActionType == EParkourActionType::Hurdle)
+	if (ActionType == EParkourActionType::Hurdle && WarpMetadata.bHasBackFloorWarp)
 	{
-		float AnimationWarpDistanceFromFrontLedgeToFloor{0.0};
-		const bool bFloorHadWarpTargets = GetAnimationDistanceFromFrontLedgeToTargetOrDeleteWarp(
-			Anim, MotionWarpingComponent, FloorName, DistanceFromLedgeName,
-			AnimationWarpDistanceFromFrontLedgeToFloor);
-
-		if (bFloorHadWarpTargets)
-		{
-			const auto AbsDistanceBackLedgeToFloor = FMath::Abs(
-				AnimationWarpDistanceFromFrontLedgeToBackLedge - AnimationWarpDistanceFromFrontLedgeToFloor);
-
-			const auto BackLedgePlane = TraversalCheck.BackLedgeLocation + (TraversalCheck.BackLedgeNormal *
-				AbsDistanceBackLedgeToFloor);
-			const FVector MotionWarpingFloorTarget{
-				BackLedgePlane.X, BackLedgePlane.Y,
-				TraversalCheck.BackFloorLocation.Z
-			};
-
-			MotionWarpingComponent->AddOrUpdateWarpTargetFromLocationAndRotation(
-				FloorName, MotionWarpingFloorTarget, FRotator::ZeroRotator);
-		}
+		const auto AbsDistanceBackLedgeToFloor = FMath::Abs(
+			WarpMetadata.BackLedgeDistance - WarpMetadata.BackFloorDistance);
+
+		const auto BackLedgePlane = TraversalCheck.BackLedgeLocation + (TraversalCheck.BackLedgeNormal *
+			AbsDistanceBackLedgeToFloor);
+		const FVector MotionWarpingFloorTarget{
+			BackLedgePlane.X, BackLedgePlane.Y,
+			TraversalCheck.BackFloorLocation.Z
+		};
+
+		MotionWarpingComponent->AddOrUpdateWarpTargetFromLocationAndRotation(
+			FloorName, MotionWarpingFloorTarget, FRotator::ZeroRotator);
 	}
 	else
 	{
@@ -338,103 +617,252 @@ bool UParkourComponent::DetermineParkourAction(
 	return bIsMantle || bIsHurdle || bIsVault;
 }
 
+FTraversalQueryRequest UParkourComponent::MakeTraversalQueryRequest(const float CapsuleRadius,
+                                                                   const float CapsuleHalfHeight) const
+{
+	FTraversalQueryRequest Request;
+	Request.Location = ControlledCharacter->GetActorLocation();
+	Request.Forward = ControlledCharacter->GetActorForwardVector();
+	Request.Velocity = ControlledCharacter->GetVelocity();
+	Request.CapsuleRotation = ControlledCharacter->GetCapsuleComponent()->GetComponentQuat();
+	Request.CapsuleRadius = CapsuleRadius;
+	Request.CapsuleHalfHeight = CapsuleHalfHeight;
+	Request.VelocityRange = VelocityRange;
+	Request.TraceRange = TraceRange;
+	Request.IgnoredActor = ControlledCharacter;
+	return Request;
+}
+
 bool UParkourComponent::PerformTraversalCheck(FTraversableCheckResult& OutTraversalCheck, float CapsuleRadius,
                                               float CapsuleHalfHeight, bool bDebugEnabled) const
 {
-	const float ForwardTraceDistance = GetForwardTraversalTraceDistance(
-		ControlledCharacter->GetVelocity(),
-		ControlledCharacter->GetActorRotation());
+	SCOPE_CYCLE_COUNTER(STAT_ParkourTraversalCheck);
 
-	const auto ActorLocation = ControlledCharacter->GetActorLocation();
-	const auto ActorForward = ControlledCharacter->GetActorForwardVector();
-	const auto CapsuleRotation = ControlledCharacter->GetCapsuleComponent()->GetComponentRotation();
+	const auto Request = MakeTraversalQueryRequest(CapsuleRadius, CapsuleHalfHeight);
+	if (const auto TraversalQueries = GetWorld()->GetSubsystem<UTraversalQuerySubsystem>())
+	{
+		FTraversalQueryResult Result;
+		const bool bHasTraversal = TraversalQueries->PerformCachedTraversalCheck(Request, Result, bDebugEnabled);
+		OutTraversalCheck = Result.TraversalCheck;
+		return bHasTraversal;
+	}
+	return UTraversalQuerySubsystem::PerformTraversalCheck(GetWorld(), Request, OutTraversalCheck, bDebugEnabled);
+}
 
-	FHitResult HitResult;
-	const auto InitialTraceEnd = ActorLocation + ActorForward * ForwardTraceDistance;
+CoroTask<TOptional<FTraversableCheckResult>> UParkourComponent::TraversalCheckTask() const
+{
+	constexpr bool bDebugEnabled{true};
 
-	static const FName CapsuleTraceSingleName(TEXT("CapsuleTraceSingleByProfile"));
-	const auto CapsuleTraceParams = FCollisionQueryParams{CapsuleTraceSingleName, false, ControlledCharacter};
+	const auto CapsuleRadius = ControlledCharacter->GetCapsuleComponent()->GetScaledCapsuleRadius();
+	const auto CapsuleHalfHeight = ControlledCharacter->GetCapsuleComponent()->GetScaledCapsuleHalfHeight();
+	FTraversableCheckResult TraversalCheck;
+	if (!PerformTraversalCheck(TraversalCheck, CapsuleRadius, CapsuleHalfHeight, bDebugEnabled))
+	{
+		co_return TOptional<FTraversableCheckResult>{};
+	}
+	co_return TraversalCheck;
+}
+
+CoroTask<TOptional<FTraversableCheckResult>> UParkourComponent::AsyncTraversalCheckTask()
+{
+	constexpr bool bDebugEnabled{true};
+
+	const auto World = GetWorld();
+	const auto CapsuleRadius = ControlledCharacter->GetCapsuleComponent()->GetScaledCapsuleRadius();
+	const auto CapsuleHalfHeight = ControlledCharacter->GetCapsuleComponent()->GetScaledCapsuleHalfHeight();
+
+	//Everything is sampled when the jump is pressed, ledges don't move so the result is still good a frame or two later.
+	const auto Request = MakeTraversalQueryRequest(CapsuleRadius, CapsuleHalfHeight);
+	const auto ActorLocation = Request.Location;
+	const auto CapsuleRotation = Request.CapsuleRotation;
+	const auto InitialTraceEnd = ActorLocation + Request.Forward * Request.GetForwardTraceDistance();
+
+	const auto CapsuleTraceParams = UTraversalQuerySubsystem::MakeQueryParams(Request);
 	const auto TraceCapsule = FCollisionShape::MakeCapsule(CapsuleRadius, CapsuleHalfHeight);
 
-	// Initial trace
-	if (!ParkourTrace(HitResult, GetWorld(), CapsuleTraceParams, TraceCapsule, CapsuleRotation.Quaternion(),
-	                  ActorLocation, InitialTraceEnd, bDebugEnabled, FColor::Green, 5.0f))
+	FHitResult HitResult;
+	auto Status = EAsyncParkourTraceStatus::Finished;
+	const auto InitialLedge = UTraversalQuerySubsystem::LookupInitialLedge(World, Request, HitResult);
+	if (InitialLedge == EInitialLedgeLookup::NoLedge)
 	{
-		return false;
+		co_return TOptional<FTraversableCheckResult>{};
+	}
+	//With the ledge straight from the index the room sweeps go out this frame, a frame sooner than after a sweep.
+	if (InitialLedge == EInitialLedgeLookup::Sweep)
+	{
+		FTraceHandle InitialTrace;
+		{
+			SCOPE_CYCLE_COUNTER(STAT_ParkourTraversalCheck);
+			InitialTrace = AsyncParkourTrace(World, CapsuleTraceParams, TraceCapsule, CapsuleRotation, ActorLocation,
+			                                 InitialTraceEnd);
+		}
+
+		// Initial trace
+		while ((Status = PollAsyncParkourTrace(World, InitialTrace, HitResult)) == EAsyncParkourTraceStatus::Pending)
+		{
+			co_await std::suspend_always{};
+		}
+		//We weren't run while the result was readable, a late check is better than dropping the jump.
+		if (Status == EAsyncParkourTraceStatus::Expired)
+		{
+			co_return co_await StateMachine.WaitForTask(TraversalCheckTask());
+		}
+		if (bDebugEnabled)
+		{
+			UTraversalQuerySubsystem::DrawTrace(World, TraceCapsule, ActorLocation, InitialTraceEnd, HitResult,
+			                                    FColor::Green, 5.0f);
+		}
 	}
 
-	const auto HitTraversable = Cast<ATraversableActor>(HitResult.GetActor());
-	if (!HitTraversable) return false;
+	if (!HitResult.bBlockingHit)
+	{
+		co_return TOptional<FTraversableCheckResult>{};
+	}
 
-	OutTraversalCheck = HitTraversable->GetLedgeTransforms(HitResult.ImpactPoint, ActorLocation);
-	OutTraversalCheck.HitComponent = HitResult.Component.Get();
+	FTraversableCheckResult TraversalCheck;
+	FVector FrontLedgeRoomCheck;
+	FVector BackLedgeRoomCheck;
+	FVector FloorCheck;
+	FTraceHandle FrontLedgeRoomTrace;
+	FTraceHandle BackLedgeRoomTrace;
+	FTraceHandle FloorTrace;
+	{
+		SCOPE_CYCLE_COUNTER(STAT_ParkourTraversalCheck);
+		if (!UTraversalQuerySubsystem::EvaluateLedges(Request, HitResult, TraversalCheck))
+		{
+			co_return TOptional<FTraversableCheckResult>{};
+		}
 
-	if (!OutTraversalCheck.bHasFrontLedge) return false;
+		FrontLedgeRoomCheck = UTraversalQuerySubsystem::GetLedgeRoomCheckLocation(
+			TraversalCheck.FrontLedgeLocation, TraversalCheck.FrontLedgeNormal, CapsuleRadius, CapsuleHalfHeight);
+		BackLedgeRoomCheck = UTraversalQuerySubsystem::GetLedgeRoomCheckLocation(
+			TraversalCheck.BackLedgeLocation, TraversalCheck.BackLedgeNormal, CapsuleRadius, CapsuleHalfHeight);
+		FloorCheck = UTraversalQuerySubsystem::GetBackFloorCheckLocation(TraversalCheck, CapsuleRadius,
+		                                                                 CapsuleHalfHeight);
+
+		//Every remaining sweep only depends on the ledges, so they're all issued together and resolve in the same frame.
+		FrontLedgeRoomTrace = AsyncParkourTrace(World, CapsuleTraceParams, TraceCapsule, CapsuleRotation, ActorLocation,
+		                                        FrontLedgeRoomCheck);
+		BackLedgeRoomTrace = AsyncParkourTrace(World, CapsuleTraceParams, TraceCapsule, CapsuleRotation,
+		                                       FrontLedgeRoomCheck, BackLedgeRoomCheck);
+		FloorTrace = AsyncParkourTrace(World, CapsuleTraceParams, TraceCapsule, CapsuleRotation, BackLedgeRoomCheck,
+		                               FloorCheck);
+	}
 
-	// Front ledge room check
-	const auto FrontLedgeRoomCheck = OutTraversalCheck.FrontLedgeLocation +
-		OutTraversalCheck.FrontLedgeNormal * (CapsuleRadius + 2.0f) +
-		FVector{0.0f, 0.0f, CapsuleHalfHeight + 2.0f};
+	FHitResult FrontLedgeRoomHit;
+	FHitResult BackLedgeRoomHit;
+	FHitResult FloorHit;
+	while ((Status = PollAsyncParkourTrace(World, FrontLedgeRoomTrace, FrontLedgeRoomHit)) ==
+		EAsyncParkourTraceStatus::Pending)
+	{
+		co_await std::suspend_always{};
+	}
+	if (Status == EAsyncParkourTraceStatus::Expired ||
+		PollAsyncParkourTrace(World, BackLedgeRoomTrace, BackLedgeRoomHit) != EAsyncParkourTraceStatus::Finished ||
+		PollAsyncParkourTrace(World, FloorTrace, FloorHit) != EAsyncParkourTraceStatus::Finished)
+	{
+		co_return co_await StateMachine.WaitForTask(TraversalCheckTask());
+	}
 
-	if (ParkourTrace(HitResult, GetWorld(), CapsuleTraceParams, TraceCapsule, CapsuleRotation.Quaternion(),
-	                 ActorLocation, FrontLedgeRoomCheck, bDebugEnabled, FColor::Red, 5.0f))
+	SCOPE_CYCLE_COUNTER(STAT_ParkourTraversalCheck);
+	if (bDebugEnabled)
 	{
-		return false;
+		UTraversalQuerySubsystem::DrawTrace(World, TraceCapsule, ActorLocation, FrontLedgeRoomCheck,
+		                                    FrontLedgeRoomHit, FColor::Red, 5.0f);
+		UTraversalQuerySubsystem::DrawTrace(World, TraceCapsule, FrontLedgeRoomCheck, BackLedgeRoomCheck,
+		                                    BackLedgeRoomHit, FColor::Yellow, 5.0f);
+		if (!BackLedgeRoomHit.bBlockingHit)
+		{
+			UTraversalQuerySubsystem::DrawTrace(World, TraceCapsule, BackLedgeRoomCheck, FloorCheck, FloorHit,
+			                                    FColor::Purple, 5.0f);
+		}
+	}
+	if (FrontLedgeRoomHit.bBlockingHit)
+	{
+		co_return TOptional<FTraversableCheckResult>{};
 	}
 
-	OutTraversalCheck.ObstacleHeight = FMath::Abs(
-		(ActorLocation - CapsuleHalfHeight - OutTraversalCheck.FrontLedgeLocation).Z);
+	UTraversalQuerySubsystem::ApplyBackLedgeHits(TraversalCheck, BackLedgeRoomHit, FloorHit);
+	co_return TraversalCheck;
+}
 
-	// Back ledge room check
-	const auto BackLedgeRoomCheck = OutTraversalCheck.BackLedgeLocation +
-		OutTraversalCheck.BackLedgeNormal * (CapsuleRadius + 2.0f) +
-		FVector{0.0f, 0.0f, CapsuleHalfHeight + 2.0f};
+void UParkourComponent::RefreshTraversalPrediction()
+{
+	const double Now = GetWorld()->GetTimeSeconds();
+	if (TraversalPrediction.bValid && Now - TraversalPrediction.SampleTime < SpeculativeRefreshInterval)
+	{
+		return;
+	}
 
-	ParkourTrace(HitResult, GetWorld(), CapsuleTraceParams, TraceCapsule, CapsuleRotation.Quaternion(),
-	             FrontLedgeRoomCheck, BackLedgeRoomCheck, bDebugEnabled, FColor::Yellow, 5.0f);
+	const auto CapsuleRadius = ControlledCharacter->GetCapsuleComponent()->GetScaledCapsuleRadius();
+	const auto CapsuleHalfHeight = ControlledCharacter->GetCapsuleComponent()->GetScaledCapsuleHalfHeight();
 
-	if (HitResult.bBlockingHit)
+	TraversalPrediction = FParkourTraversalPrediction{};
+	FTraversableCheckResult TraversalCheck;
+	if (PerformTraversalCheck(TraversalCheck, CapsuleRadius, CapsuleHalfHeight, false))
 	{
-		OutTraversalCheck.ObstacleDepth = (HitResult.ImpactPoint - OutTraversalCheck.FrontLedgeLocation).Size2D();
-		OutTraversalCheck.bHasBackLedge = false;
+		if (TraversalCheck.HitComponent)
+		{
+			TraversalPrediction.Traversable = TraversalCheck.HitComponent;
+			TraversalPrediction.TraversableTransform = TraversalCheck.HitComponent->GetComponentTransform();
+		}
+		TraversalPrediction.TraversalCheck = TraversalCheck;
 	}
-	else
+	TraversalPrediction.SampleLocation = ControlledCharacter->GetActorLocation();
+	TraversalPrediction.SampleRotation = ControlledCharacter->GetActorRotation();
+	TraversalPrediction.SampleTime = Now;
+	TraversalPrediction.bValid = true;
+}
+
+bool UParkourComponent::IsTraversalPredictionUsable() const
+{
+	if (!TraversalPrediction.bValid)
 	{
-		OutTraversalCheck.ObstacleDepth = (OutTraversalCheck.FrontLedgeLocation - OutTraversalCheck.BackLedgeLocation).
-			Size2D();
+		return false;
+	}
 
-		const auto FloorCheck = (OutTraversalCheck.BackLedgeLocation +
-				OutTraversalCheck.BackLedgeNormal * (CapsuleRadius + 2.0f)) -
-			FVector{0.0f, 0.0f, (OutTraversalCheck.ObstacleHeight - CapsuleHalfHeight) + 50.0f};
+	if (FVector::DistSquared(TraversalPrediction.SampleLocation, ControlledCharacter->GetActorLocation()) >
+		FMath::Square(SpeculativeInvalidationDistance))
+	{
+		return false;
+	}
 
-		ParkourTrace(HitResult, GetWorld(), CapsuleTraceParams, TraceCapsule, CapsuleRotation.Quaternion(),
-		             BackLedgeRoomCheck, FloorCheck, bDebugEnabled, FColor::Purple, 5.0f);
+	const auto YawDelta = FRotator::NormalizeAxis(
+		ControlledCharacter->GetActorRotation().Yaw - TraversalPrediction.SampleRotation.Yaw);
+	if (FMath::Abs(YawDelta) > SpeculativeInvalidationAngle)
+	{
+		return false;
+	}
 
-		if (HitResult.bBlockingHit)
+	//The obstacle we predicted against was destroyed or moved since.
+	if (TraversalPrediction.TraversalCheck && TraversalPrediction.TraversalCheck->HitComponent)
+	{
+		const auto Traversable = TraversalPrediction.Traversable.Get();
+		if (!Traversable || !Traversable->GetComponentTransform().Equals(TraversalPrediction.TraversableTransform))
 		{
-			OutTraversalCheck.BackFloorLocation = HitResult.ImpactPoint;
-			OutTraversalCheck.BackLedgeHeight = FMath::Abs(
-				(HitResult.ImpactPoint - OutTraversalCheck.BackLedgeLocation).Z);
-			OutTraversalCheck.bHasBackFloor = true;
+			return false;
 		}
 	}
 
 	return true;
 }
 
-bool UParkourComponent::TryTraversalAction(FTraversableCheckResult& OutTraversalData,
-                                           EParkourActionType& OutParkourAction)
+bool UParkourComponent::FindTraversalAction(FTraversableCheckResult& OutTraversalCheck,
+                                            EParkourActionType& OutParkourAction) const
 {
 	constexpr bool bDebugEnabled{true};
 
 	const auto CapsuleRadius = ControlledCharacter->GetCapsuleComponent()->GetScaledCapsuleRadius();
 	const auto CapsuleHalfHeight = ControlledCharacter->GetCapsuleComponent()->GetScaledCapsuleHalfHeight();
-	FTraversableCheckResult TraversalCheck;
-	if (!PerformTraversalCheck(TraversalCheck, CapsuleRadius, CapsuleHalfHeight, bDebugEnabled)) return false;
+	if (!PerformTraversalCheck(OutTraversalCheck, CapsuleRadius, CapsuleHalfHeight, bDebugEnabled)) return false;
 
-	EParkourActionType ActionType;
-	if (!DetermineParkourAction(TraversalCheck, bDebugEnabled, ActionType)) return false;
+	return DetermineParkourAction(OutTraversalCheck, bDebugEnabled, OutParkourAction);
+}
 
+bool UParkourComponent::StartTraversalAction(const FTraversableCheckResult& TraversalCheck,
+                                             const EParkourActionType ActionType,
+                                             const FParkourMontageSelection* MontageSelection)
+{
 	//This seems to actually just be a problem, idk why it exists.
 	//ControlledCharacter->GetCapsuleComponent()->IgnoreComponentWhenMoving(TraversalCheck.HitComponent, true);
 	OnSetInteractionTransform.Broadcast(FTransform(TraversalCheck.FrontLedgeNormal.Rotation().Quaternion(),
@@ -454,7 +882,13 @@ bool UParkourComponent::TryTraversalAction(FTraversableCheckResult& OutTraversal
 	UAnimMontage* Anim;
 	float Time;
 	float PlayRate;
-	if (!SelectParkourMontage(ActionType, TraversalCheck, Anim, Time, PlayRate))
+	if (MontageSelection && MontageSelection->Anim)
+	{
+		Anim = MontageSelection->Anim;
+		Time = MontageSelection->Time;
+		PlayRate = MontageSelection->PlayRate;
+	}
+	else if (!SelectParkourMontage(ActionType, TraversalCheck, Anim, Time, PlayRate))
 	{
 		UE_LOG(LogTemp, Warning, TEXT("Failed to find montage."))
 		return false;
@@ -466,6 +900,16 @@ bool UParkourComponent::TryTraversalAction(FTraversableCheckResult& OutTraversal
 	MovementComponent->SetMovementMode(MOVE_Flying);
 	
 	AnimInstance->Montage_Play(Anim, PlayRate, EMontagePlayReturnType::MontageLength, Time);
+
+	if (!bFirstTraversalMeasured)
+	{
+		bFirstTraversalMeasured = true;
+		const auto WarmUpState = !bWarmUpTraversalAssets
+			                         ? TEXT("disabled")
+			                         : bTraversalWarmUpFinished ? TEXT("finished") : TEXT("pending");
+		UE_LOGFMT(LogTemp, Log, "First traversal latency: {0} ms, warm-up {1}.",
+		          (FPlatformTime::Seconds() - TraversalRequestTime) * 1000.0, WarmUpState);
+	}
 	
 	bCurrentlyTraversing = true;
 	if (ActionType == EParkourActionType::Vault)
@@ -487,11 +931,50 @@ bool UParkourComponent::TryTraversalAction(FTraversableCheckResult& OutTraversal
 		}
 	}
 
+	return true;
+}
+
+bool UParkourComponent::TryTraversalAction(FTraversableCheckResult& OutTraversalData,
+                                           EParkourActionType& OutParkourAction)
+{
+	FTraversableCheckResult TraversalCheck;
+	EParkourActionType ActionType;
+	if (!FindTraversalAction(TraversalCheck, ActionType)) return false;
+	if (!StartTraversalAction(TraversalCheck, ActionType)) return false;
+
 	OutTraversalData = TraversalCheck;
 	OutParkourAction = ActionType;
 	return true;
 }
 
+void UParkourComponent::ApplyCommands()
+{
+	if (Commands.MaxWalkSpeed)
+	{
+		MovementComponent->MaxWalkSpeed = *Commands.MaxWalkSpeed;
+	}
+	if (Commands.UpdateRotation)
+	{
+		UpdateRotation(*Commands.UpdateRotation);
+	}
+	if (Commands.bStartMontageSearch)
+	{
+		bMontageSearchPending = true;
+		PendingMontageSearchCheck = Commands.TraversalCheck;
+		PendingMontageSearchAction = Commands.ParkourAction;
+	}
+	if (Commands.bStartTraversal && !StartTraversalAction(Commands.TraversalCheck, Commands.ParkourAction,
+	                                                      Commands.MontageSelection.GetPtrOrNull()))
+	{
+		Commands.bJump = true;
+	}
+	if (Commands.bJump)
+	{
+		ControlledCharacter->Jump();
+	}
+	Commands.Reset();
+}
+
 void UParkourComponent::OnAnimInstanceMontageEndOrAbort(UAnimMontage* Montage, bool bInterrupted)
 {
 	const auto AnimInstance = ControlledCharacter->GetMesh()->GetAnimInstance();
@@ -516,37 +999,103 @@ void UParkourComponent::Jump(const FInputActionValue& InputActionValue)
 	//If you want the character to only be able to parkour while grounded.
 	//if(!MovementComponent->IsMovingOnGround()) return;
 	bWantsToJump = true;
+	ParkourInputEvent.Signal();
+	//Each press restarts the clock, only the one that ends up traversing counts.
+	if (!bFirstTraversalMeasured)
+	{
+		TraversalRequestTime = FPlatformTime::Seconds();
+	}
 }
 
 void UParkourComponent::StrafeToggle(const FInputActionValue& InputActionValue)
 {
 	bWantsToStrafe = !bWantsToStrafe;
+	ParkourInputEvent.Signal();
 }
 
 void UParkourComponent::Aim(const FInputActionValue& InputActionValue)
 {
 	bWantsToAim = InputActionValue.Get<bool>();
 	bWantsToStrafe |= bWantsToAim;
+	ParkourInputEvent.Signal();
+}
+
+bool UParkourComponent::CanParkStateMachine() const
+{
+	//A standing character's speed and rotation commands stay the same until one of the inputs signals otherwise.
+	return !bWantsToJump && !bCurrentlyTraversing && !bUseSpeculativeTraversalCheck &&
+		MovementComponent->IsMovingOnGround() && MovementComponent->Velocity.IsNearlyZero();
 }
 
 CoroState UParkourComponent::ParkourStateMachine()
 {
 	while (true)
 	{
-		co_await std::suspend_always{};
-		const auto MaxSpeed = CalculateMaxSpeed();
-		MovementComponent->MaxWalkSpeed = MaxSpeed;
-		UpdateRotation(!bWantsToStrafe);
+		if (CanParkStateMachine())
+		{
+			//Parked machines drop out of the scheduler's loop until an input wakes them.
+			co_await StateMachine.WaitUntilSignaled(ParkourInputEvent);
+		}
+		else
+		{
+			co_await std::suspend_always{};
+		}
+		//Only reads the world, everything it wants changed goes through Commands.
+		Commands.MaxWalkSpeed = CalculateMaxSpeed();
+		Commands.UpdateRotation = !bWantsToStrafe;
 
 		if (bWantsToJump)
 		{
-			FTraversableCheckResult TraversalCheck;
-			EParkourActionType ActionType;
 			bWantsToJump = false;
-			if (!TryTraversalAction(TraversalCheck, ActionType))
+
+			TOptional<FTraversableCheckResult> TraversalCheck;
+			if (bUseSpeculativeTraversalCheck && IsTraversalPredictionUsable())
+			{
+				++SpeculativeHits;
+				INC_DWORD_STAT(STAT_ParkourSpeculativeHits);
+				TraversalCheck = TraversalPrediction.TraversalCheck;
+			}
+			else
+			{
+				if (bUseSpeculativeTraversalCheck)
+				{
+					++SpeculativeMisses;
+					INC_DWORD_STAT(STAT_ParkourSpeculativeMisses);
+				}
+
+				//The blocking check finishes within this tick, the async one a frame or two later without stalling the game thread.
+				//Async sweeps can only be requested from the game thread, a parallel machine always uses the blocking check.
+				TraversalCheck = co_await StateMachine.WaitForTask(
+					bUseAsyncTraversalCheck && IsInGameThread() ? AsyncTraversalCheckTask() : TraversalCheckTask());
+			}
+			if (TraversalCheck && DetermineParkourAction(*TraversalCheck, true, Commands.ParkourAction))
 			{
-				ControlledCharacter->Jump();
-			} //...
+				Commands.TraversalCheck = *TraversalCheck;
+				if (bUseAsyncMontageSelection)
+				{
+					//The montage is picked on a worker while we wait, the traversal starts a frame or two later.
+					const auto ActionType = Commands.ParkourAction;
+					Commands.bStartMontageSearch = true;
+					const auto MontageSelection = co_await StateMachine.WaitForTask(MontageSelectionTask(ActionType));
+
+					//The commands were applied and reset while we waited.
+					Commands.TraversalCheck = *TraversalCheck;
+					Commands.ParkourAction = ActionType;
+					Commands.MontageSelection = MontageSelection;
+					Commands.bStartTraversal = MontageSelection.IsSet();
+				}
+				else
+				{
+					Commands.bStartTraversal = true;
+				}
+			}
+			Commands.bJump = !Commands.bStartTraversal;
+			//Whatever happens next moves the character, the next refresh starts from scratch.
+			TraversalPrediction.bValid = false;
+		}
+		else if (bUseSpeculativeTraversalCheck && !bCurrentlyTraversing)
+		{
+			RefreshTraversalPrediction();
 		}
 	}
 }
@@ -561,6 +1110,39 @@ void UParkourComponent::BeginPlay()
 	check(ControlledCharacter);
 	check(MovementComponent);
 	StateMachine.ChangeToState(ParkourStateMachine());
+	StartTraversalWarmUp();
+
+	//State machine, then the fence, then the mesh, then the search launch. The search runs from one animation update
+	//to the next and only holds up the game thread if it's still going when the next one starts.
+	if (bUseAsyncMontageSelection)
+	{
+		const auto Mesh = ControlledCharacter->GetMesh();
+		MontageSearchFence.Component = this;
+		MontageSearchFence.bCanEverTick = true;
+		MontageSearchFence.TickGroup = TG_PrePhysics;
+		MontageSearchFence.RegisterTickFunction(GetOwner()->GetLevel());
+		MontageSearchFence.AddPrerequisite(this, PrimaryComponentTick);
+		Mesh->PrimaryComponentTick.AddPrerequisite(this, MontageSearchFence);
+
+		MontageSearchLaunch.Component = this;
+		MontageSearchLaunch.bCanEverTick = true;
+		MontageSearchLaunch.TickGroup = TG_PrePhysics;
+		MontageSearchLaunch.RegisterTickFunction(GetOwner()->GetLevel());
+		MontageSearchLaunch.AddPrerequisite(Mesh, Mesh->PrimaryComponentTick);
+	}
+
+	if (bUseBatchedScheduler)
+	{
+		if (const auto Scheduler = GetWorld()->GetSubsystem<UCoroSchedulerSubsystem>())
+		{
+			Scheduler->RegisterMachine(StateMachine, this, [this] { ApplyCommands(); }, bRunStateMachineInParallel);
+			SetComponentTickEnabled(false);
+			if (bUseAsyncMontageSelection)
+			{
+				Scheduler->AddRunPrerequisite(MontageSearchFence);
+			}
+		}
+	}
 
 	const auto EnhancedInputComponent = CastChecked<UEnhancedPlayerInputComponent>(ControlledCharacter->InputComponent);
 	EnhancedInputComponent->BindAction(MoveAction, ETriggerEvent::Triggered, this, &ThisClass::Move);
@@ -573,6 +1155,37 @@ void UParkourComponent::BeginPlay()
 	EnhancedInputComponent->BindAction(AimAction, ETriggerEvent::Triggered, this, &ThisClass::Aim);
 }
 
+void UParkourComponent::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	WaitForMontageSearch();
+	if (MontageSearchFence.IsTickFunctionRegistered())
+	{
+		ControlledCharacter->GetMesh()->PrimaryComponentTick.RemovePrerequisite(this, MontageSearchFence);
+		MontageSearchFence.UnRegisterTickFunction();
+	}
+	MontageSearchFence.Component = nullptr;
+	if (MontageSearchLaunch.IsTickFunctionRegistered())
+	{
+		MontageSearchLaunch.UnRegisterTickFunction();
+	}
+	MontageSearchLaunch.Component = nullptr;
+	bMontageSearchPending = false;
+
+	if (TraversalWarmUpHandle && TraversalWarmUpHandle->IsLoadingInProgress())
+	{
+		TraversalWarmUpHandle->CancelHandle();
+	}
+	TraversalWarmUpHandle.Reset();
+	GetWorld()->GetTimerManager().ClearTimer(PoseSearchIndexBuildTimer);
+	PendingPoseSearchIndexBuilds.Reset();
+
+	if (const auto Scheduler = GetWorld()->GetSubsystem<UCoroSchedulerSubsystem>())
+	{
+		Scheduler->UnregisterMachine(StateMachine);
+	}
+	Super::EndPlay(EndPlayReason);
+}
+
 void UParkourComponent::BeginDestroy()
 {
 	StateMachine.Destroy();
@@ -584,4 +1197,5 @@ void UParkourComponent::TickComponent(float DeltaTime, ELevelTick TickType,
 {
 	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
 	StateMachine.Run();
+	ApplyCommands();
 }
@@ -0,0 +1,87 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Parkour/TraversalWarpTable.h"
+
+#include "AnimationWarpingLibrary.h"
+#include "MotionWarpingComponent.h"
+#include "Animation/AnimMontage.h"
+
+namespace
+{
+	//Returns false when the montage has no warp window for the target.
+	bool BakeWarpTarget(const UAnimMontage* Montage, const FName& WarpTargetName, float& OutWindowEnd,
+	                    float& OutDistance)
+	{
+		static const auto DistanceFromLedgeName = FName(TEXT("Distance_From_Ledge"));
+
+		TArray<FMotionWarpingWindowData> Windows;
+		UMotionWarpingUtilities::GetMotionWarpingWindowsForWarpTargetFromAnimation(Montage, WarpTargetName, Windows);
+		if (Windows.IsEmpty())
+		{
+			return false;
+		}
+
+		OutWindowEnd = Windows[0].EndTime;
+		UAnimationWarpingLibrary::GetCurveValueFromAnimation(Montage, DistanceFromLedgeName, OutWindowEnd, OutDistance);
+		return true;
+	}
+}
+
+const FTraversalWarpMetadata* FTraversalWarpTable::Find(const UAnimMontage* Montage) const
+{
+	const auto Index = Indices.Find(Montage);
+	return Index ? &Entries[*Index] : nullptr;
+}
+
+const FTraversalWarpMetadata& FTraversalWarpTable::FindOrAdd(const UAnimMontage* Montage)
+{
+	if (const auto Index = Indices.Find(Montage))
+	{
+		return Entries[*Index];
+	}
+
+	Indices.Add(Montage, Entries.Num());
+	Keys.Add(Montage);
+	return Entries.Add_GetRef(BakeMetadata(Montage));
+}
+
+void FTraversalWarpTable::Remove(const UAnimMontage* Montage)
+{
+	int32 Index;
+	if (!Indices.RemoveAndCopyValue(Montage, Index))
+	{
+		return;
+	}
+
+	//The last entry moves into the hole.
+	Entries.RemoveAtSwap(Index, 1, EAllowShrinking::No);
+	Keys.RemoveAtSwap(Index, 1, EAllowShrinking::No);
+	if (Keys.IsValidIndex(Index))
+	{
+		Indices[Keys[Index]] = Index;
+	}
+}
+
+void FTraversalWarpTable::Reset()
+{
+	Indices.Reset();
+	Entries.Reset();
+	Keys.Reset();
+}
+
+FTraversalWarpMetadata FTraversalWarpTable::BakeMetadata(const UAnimMontage* Montage)
+{
+	static const auto BackLedgeName = FName(TEXT("BackLedge"));
+	static const auto FloorName = FName(TEXT("BackFloor"));
+
+	FTraversalWarpMetadata Metadata;
+	if (Montage)
+	{
+		Metadata.bHasBackLedgeWarp = BakeWarpTarget(Montage, BackLedgeName, Metadata.BackLedgeWindowEnd,
+		                                            Metadata.BackLedgeDistance);
+		Metadata.bHasBackFloorWarp = BakeWarpTarget(Montage, FloorName, Metadata.BackFloorWindowEnd,
+		                                            Metadata.BackFloorDistance);
+	}
+	return Metadata;
+}
@@ -0,0 +1,526 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Scheduling/CoroSchedulerSubsystem.h"
+
+#include "Async/ParallelFor.h"
+#include "CoroStateMachine/CoroStateMachine.h"
+#include "Engine/World.h"
+#include "GameFramework/Pawn.h"
+#include "GameFramework/PlayerController.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformTime.h"
+
+DECLARE_CYCLE_STAT(TEXT("Run Machines"), STAT_CoroSchedulerRunMachines, STATGROUP_CoroScheduler);
+DECLARE_CYCLE_STAT(TEXT("Parallel Phase"), STAT_CoroSchedulerParallelPhase, STATGROUP_CoroScheduler);
+DECLARE_CYCLE_STAT(TEXT("Flush Commands"), STAT_CoroSchedulerFlushCommands, STATGROUP_CoroScheduler);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Registered Machines"), STAT_CoroSchedulerRegisteredMachines, STATGROUP_CoroScheduler);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Active Machines"), STAT_CoroSchedulerActiveMachines, STATGROUP_CoroScheduler);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Deferred Machines"), STAT_CoroSchedulerDeferredMachines, STATGROUP_CoroScheduler);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Parallel Machines"), STAT_CoroSchedulerParallelMachines, STATGROUP_CoroScheduler);
+
+static TAutoConsoleVariable<float> CVarCoroSchedulerBudgetMs(
+	TEXT("Coro.Scheduler.BudgetMs"),
+	0.0f,
+	TEXT("Milliseconds per frame the scheduler may spend running state machines, 0 runs every machine every frame."));
+
+static TAutoConsoleVariable<int32> CVarCoroSchedulerStarvationFrames(
+	TEXT("Coro.Scheduler.StarvationFrames"),
+	4,
+	TEXT("Frames a machine can be deferred by the budget before it's run regardless."));
+
+namespace
+{
+	const AActor* GetRecordActor(const UObject* Owner)
+	{
+		if (const auto Component = Cast<UActorComponent>(Owner))
+		{
+			return Component->GetOwner();
+		}
+		return Cast<AActor>(Owner);
+	}
+}
+
+void FCoroSchedulerTickFunction::ExecuteTick(const float DeltaTime, ELevelTick TickType,
+                                             ENamedThreads::Type CurrentThread,
+                                             const FGraphEventRef& MyCompletionGraphEvent)
+{
+	if (Scheduler)
+	{
+		Scheduler->RunMachines(DeltaTime);
+	}
+}
+
+FString FCoroSchedulerTickFunction::DiagnosticMessage()
+{
+	return TEXT("FCoroSchedulerTickFunction");
+}
+
+void FCoroSchedulerSleepHost::OnMachineSuspended(CoroStateMachine& Machine)
+{
+	if (!Scheduler || !Machine.CanPark())
+	{
+		return;
+	}
+	if (bDeferParking)
+	{
+		FScopeLock Lock(&PendingLock);
+		PendingParking.Emplace(&Machine, true);
+		return;
+	}
+	Scheduler->ParkMachine(Machine);
+}
+
+void FCoroSchedulerSleepHost::OnMachineWoken(CoroStateMachine& Machine)
+{
+	if (!Scheduler)
+	{
+		return;
+	}
+	if (bDeferParking)
+	{
+		FScopeLock Lock(&PendingLock);
+		PendingParking.Emplace(&Machine, false);
+		return;
+	}
+	Scheduler->UnparkMachine(Machine);
+}
+
+void FCoroSchedulerSleepHost::FlushPendingParking()
+{
+	//Replayed in the order they happened, a machine that slept and woke again in the same phase ends up active.
+	for (const auto& [Machine, bPark] : PendingParking)
+	{
+		if (bPark)
+		{
+			if (Machine->CanPark())
+			{
+				Scheduler->ParkMachine(*Machine);
+			}
+		}
+		else
+		{
+			Scheduler->UnparkMachine(*Machine);
+		}
+	}
+	PendingParking.Reset();
+}
+
+void UCoroSchedulerSubsystem::RegisterMachine(CoroStateMachine& Machine, UObject* Owner,
+                                              TFunction<void()> FlushCommands, const bool bRunInParallel)
+{
+	check(Machine.HostSlot == INDEX_NONE);
+
+	//New machines are active, the first parked record moves to the back to make room.
+	Records.Add(FCoroSchedulerRecord{&Machine, Owner, MoveTemp(FlushCommands), NextRegistrationId++, 0, bRunInParallel});
+	Machine.HostSlot = Records.Num() - 1;
+	SwapRecords(NumActive, Records.Num() - 1);
+	++NumActive;
+
+	SleepHost.Scheduler = this;
+	Machine.SetSleepHost(&SleepHost);
+}
+
+void UCoroSchedulerSubsystem::UnregisterMachine(CoroStateMachine& Machine)
+{
+	const auto Index = Machine.HostSlot;
+	if (!Records.IsValidIndex(Index) || Records[Index].Machine != &Machine)
+	{
+		return;
+	}
+
+	//Detaching wakes the machine, so it's active again by the time we remove it.
+	Machine.SetSleepHost(nullptr);
+
+	//A machine can unregister itself while the batch is running, so only clear the slot until the loop is done.
+	if (bRunningMachines)
+	{
+		Records[Machine.HostSlot].Machine = nullptr;
+		Machine.HostSlot = INDEX_NONE;
+		bHasPendingRemovals = true;
+		return;
+	}
+	RemoveRecordAt(Machine.HostSlot);
+}
+
+void UCoroSchedulerSubsystem::ParkMachine(const CoroStateMachine& Machine)
+{
+	const auto Index = Machine.HostSlot;
+	if (Index == INDEX_NONE || Index >= NumActive)
+	{
+		return;
+	}
+	SwapRecords(Index, NumActive - 1);
+	--NumActive;
+}
+
+void UCoroSchedulerSubsystem::UnparkMachine(const CoroStateMachine& Machine)
+{
+	const auto Index = Machine.HostSlot;
+	if (Index == INDEX_NONE || Index < NumActive)
+	{
+		return;
+	}
+	SwapRecords(Index, NumActive);
+	++NumActive;
+}
+
+void UCoroSchedulerSubsystem::AddRunPrerequisite(FTickFunction& Dependent)
+{
+	Dependent.AddPrerequisite(this, TickFunction);
+}
+
+void UCoroSchedulerSubsystem::SwapRecords(const int32 A, const int32 B)
+{
+	if (A == B)
+	{
+		return;
+	}
+	Records.Swap(A, B);
+	if (Records[A].Machine)
+	{
+		Records[A].Machine->HostSlot = A;
+	}
+	if (Records[B].Machine)
+	{
+		Records[B].Machine->HostSlot = B;
+	}
+}
+
+void UCoroSchedulerSubsystem::RemoveRecordAt(int32 Index)
+{
+	if (Index < NumActive)
+	{
+		SwapRecords(Index, NumActive - 1);
+		Index = NumActive - 1;
+		--NumActive;
+	}
+	SwapRecords(Index, Records.Num() - 1);
+	if (const auto Machine = Records.Last().Machine)
+	{
+		Machine->HostSlot = INDEX_NONE;
+	}
+	Records.Pop(EAllowShrinking::No);
+}
+
+void UCoroSchedulerSubsystem::RunMachines(const float DeltaTime)
+{
+	SCOPE_CYCLE_COUNTER(STAT_CoroSchedulerRunMachines);
+
+	//Fires timers first, anything waking up this frame rejoins the active range before we walk it.
+	SleepHost.Advance(DeltaTime);
+
+	SET_DWORD_STAT(STAT_CoroSchedulerRegisteredMachines, Records.Num());
+	SET_DWORD_STAT(STAT_CoroSchedulerActiveMachines, NumActive);
+
+	bRunningMachines = true;
+	const auto BudgetMs = CVarCoroSchedulerBudgetMs.GetValueOnGameThread();
+	if (BudgetMs > 0.0f)
+	{
+		RunMachinesWithinBudget(BudgetMs / 1000.0);
+	}
+	else
+	{
+		RunAllMachines();
+	}
+	RunParallelBatch();
+	bRunningMachines = false;
+
+	SET_DWORD_STAT(STAT_CoroSchedulerDeferredMachines, LastFrameDeferredCount);
+
+	if (bHasPendingRemovals)
+	{
+		for (int32 i = Records.Num() - 1; i >= 0; --i)
+		{
+			if (i < Records.Num() && !Records[i].Machine)
+			{
+				RemoveRecordAt(i);
+			}
+		}
+		bHasPendingRemovals = false;
+	}
+}
+
+void UCoroSchedulerSubsystem::RunAllMachines()
+{
+	//Walked back to front, a machine parking itself only swaps with records we've already run.
+	for (int32 i = NumActive - 1; i >= 0; --i)
+	{
+		auto& Record = Records[i];
+		Record.FramesDeferred = 0;
+		if (Record.Machine && Record.Owner.IsValid())
+		{
+			RunOrQueueMachine(Record);
+		}
+	}
+	LastFrameDeferredCount = 0;
+}
+
+void UCoroSchedulerSubsystem::RunOrQueueMachine(FCoroSchedulerRecord& Record)
+{
+	if (Record.bRunInParallel)
+	{
+		ParallelBatch.Emplace(Record.RegistrationId, Record.Machine);
+		return;
+	}
+
+	//Copied out, running can park the machine and move its record.
+	const auto Machine = Record.Machine;
+	Machine->Run();
+	FlushMachine(*Machine);
+}
+
+void UCoroSchedulerSubsystem::FlushMachine(const CoroStateMachine& Machine)
+{
+	const auto Index = Machine.HostSlot;
+	if (Records.IsValidIndex(Index) && Records[Index].Machine == &Machine && Records[Index].FlushCommands)
+	{
+		Records[Index].FlushCommands();
+	}
+}
+
+void UCoroSchedulerSubsystem::RunParallelBatch()
+{
+	SET_DWORD_STAT(STAT_CoroSchedulerParallelMachines, ParallelBatch.Num());
+	if (ParallelBatch.IsEmpty())
+	{
+		return;
+	}
+
+	{
+		SCOPE_CYCLE_COUNTER(STAT_CoroSchedulerParallelPhase);
+		SleepHost.bDeferParking = true;
+		ParallelFor(ParallelBatch.Num(), [this](const int32 Index)
+		{
+			ParallelBatch[Index].Value->Run();
+		});
+		SleepHost.bDeferParking = false;
+		SleepHost.FlushPendingParking();
+	}
+
+	{
+		SCOPE_CYCLE_COUNTER(STAT_CoroSchedulerFlushCommands);
+		ParallelBatch.Sort([](const TPair<uint32, CoroStateMachine*>& A, const TPair<uint32, CoroStateMachine*>& B)
+		{
+			return A.Key < B.Key;
+		});
+		for (const auto& [RegistrationId, Machine] : ParallelBatch)
+		{
+			FlushMachine(*Machine);
+		}
+	}
+	ParallelBatch.Reset();
+}
+
+void UCoroSchedulerSubsystem::BuildBudgetedRunOrder()
+{
+	TArray<FVector, TInlineAllocator<4>> ViewLocations;
+	for (auto It = GetWorld()->GetPlayerControllerIterator(); It; ++It)
+	{
+		if (const auto PlayerController = It->Get())
+		{
+			FVector ViewLocation;
+			FRotator ViewRotation;
+			PlayerController->GetPlayerViewPoint(ViewLocation, ViewRotation);
+			ViewLocations.Add(ViewLocation);
+		}
+	}
+
+	const auto StarvationFrames = static_cast<uint32>(FMath::Max(1, CVarCoroSchedulerStarvationFrames.GetValueOnGameThread()));
+
+	BudgetedRunOrder.Reset();
+	for (int32 i = 0; i < NumActive; ++i)
+	{
+		const auto& Record = Records[i];
+		if (!Record.Machine || !Record.Owner.IsValid())
+		{
+			continue;
+		}
+
+		FCoroBudgetedRun Run;
+		Run.Machine = Record.Machine;
+		Run.FramesDeferred = Record.FramesDeferred;
+		Run.bStarving = Record.FramesDeferred >= StarvationFrames;
+
+		const auto Actor = GetRecordActor(Record.Owner.Get());
+		const auto Pawn = Cast<APawn>(Actor);
+		Run.bPlayer = Pawn && Pawn->IsPlayerControlled();
+
+		float ClosestDistanceSquared = TNumericLimits<float>::Max();
+		if (Actor)
+		{
+			for (const auto& ViewLocation : ViewLocations)
+			{
+				ClosestDistanceSquared = FMath::Min(ClosestDistanceSquared,
+				                                    static_cast<float>(FVector::DistSquared(
+					                                    ViewLocation, Actor->GetActorLocation())));
+			}
+		}
+		Run.Priority = -ClosestDistanceSquared;
+		BudgetedRunOrder.Add(Run);
+	}
+
+	//Stable, so machines that tie keep their record order from frame to frame.
+	BudgetedRunOrder.StableSort([](const FCoroBudgetedRun& A, const FCoroBudgetedRun& B)
+	{
+		return A.RunsBefore(B);
+	});
+}
+
+void UCoroSchedulerSubsystem::RunMachinesWithinBudget(const double BudgetSeconds)
+{
+	BuildBudgetedRunOrder();
+
+	const auto StartTime = FPlatformTime::Seconds();
+	int32 DeferredCount = 0;
+
+	for (const auto& Run : BudgetedRunOrder)
+	{
+		const auto Machine = Run.Machine;
+		//Anything run earlier this frame may have unregistered or parked this machine.
+		const auto Index = Machine->HostSlot;
+		if (Index == INDEX_NONE || Index >= NumActive || Records[Index].Machine != Machine)
+		{
+			continue;
+		}
+
+		auto& Record = Records[Index];
+		if (!Run.MustRun() && FPlatformTime::Seconds() - StartTime >= BudgetSeconds)
+		{
+			++Record.FramesDeferred;
+			++DeferredCount;
+			continue;
+		}
+
+		Record.FramesDeferred = 0;
+		RunOrQueueMachine(Record);
+	}
+
+	LastFrameDeferredCount = DeferredCount;
+}
+
+void UCoroSchedulerSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	//Same group components tick in by default, so batching doesn't change when state machines see the world.
+	TickFunction.Scheduler = this;
+	TickFunction.bCanEverTick = true;
+	TickFunction.TickGroup = TG_PrePhysics;
+	TickFunction.RegisterTickFunction(InWorld.PersistentLevel);
+}
+
+void UCoroSchedulerSubsystem::Deinitialize()
+{
+	if (TickFunction.IsTickFunctionRegistered())
+	{
+		TickFunction.UnRegisterTickFunction();
+	}
+	TickFunction.Scheduler = nullptr;
+	SleepHost.Scheduler = nullptr;
+
+	for (const auto& Record : Records)
+	{
+		if (Record.Machine)
+		{
+			Record.Machine->SetSleepHost(nullptr);
+			Record.Machine->HostSlot = INDEX_NONE;
+		}
+	}
+	Records.Empty();
+	NumActive = 0;
+
+	Super::Deinitialize();
+}
+
+bool UCoroSchedulerSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+#if !UE_BUILD_SHIPPING
+
+namespace CoroSchedulerBenchmark
+{
+	volatile float Sink{0.0f};
+
+	//Stands in for a parkour machine, some math every Run and nothing to wait on.
+	CoroState BusyState(const int32 WorkIterations)
+	{
+		while (true)
+		{
+			float Accumulator = Sink;
+			for (int32 i = 0; i < WorkIterations; ++i)
+			{
+				Accumulator += FMath::Sin(Accumulator + i);
+			}
+			Sink = Accumulator;
+			co_await std::suspend_always{};
+		}
+	}
+}
+
+//Runs N dummy machines through a private scheduler in each mode so live machines aren't advanced extra frames.
+static FAutoConsoleCommandWithWorldAndArgs CoroSchedulerBenchmarkCommand(
+	TEXT("Coro.Scheduler.Benchmark"),
+	TEXT("Logs scheduler ms per frame for 1, 8, 64 and 256 machines in the serial, budgeted and parallel modes. ")
+	TEXT("Usage: Coro.Scheduler.Benchmark [Frames] [WorkIterations] [BudgetMs]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		if (!World)
+		{
+			return;
+		}
+
+		const int32 Frames = Args.Num() > 0 ? FMath::Max(1, FCString::Atoi(*Args[0])) : 200;
+		const int32 WorkIterations = Args.Num() > 1 ? FMath::Max(0, FCString::Atoi(*Args[1])) : 256;
+		const float BudgetMs = Args.Num() > 2 ? FMath::Max(0.01f, FCString::Atof(*Args[2])) : 0.5f;
+
+		enum class EMode : uint8 { Serial, Budgeted, Parallel };
+		const auto BudgetVariable = CVarCoroSchedulerBudgetMs.AsVariable();
+		const float PreviousBudgetMs = CVarCoroSchedulerBudgetMs.GetValueOnGameThread();
+
+		for (const int32 NumMachines : {1, 8, 64, 256})
+		{
+			for (const auto Mode : {EMode::Serial, EMode::Budgeted, EMode::Parallel})
+			{
+				const auto Scheduler = NewObject<UCoroSchedulerSubsystem>(World, NAME_None, RF_Transient);
+				TArray<TUniquePtr<CoroStateMachine>> Machines;
+				for (int32 i = 0; i < NumMachines; ++i)
+				{
+					auto& Machine = Machines.Add_GetRef(MakeUnique<CoroStateMachine>());
+					Machine->ChangeToState(CoroSchedulerBenchmark::BusyState(WorkIterations));
+					Scheduler->RegisterMachine(*Machine, World, nullptr, Mode == EMode::Parallel);
+				}
+
+				BudgetVariable->SetWithCurrentPriority(Mode == EMode::Budgeted ? BudgetMs : 0.0f);
+				//One untimed frame so every machine has started and its frame is warm.
+				Scheduler->RunMachines(1.0f / 60.0f);
+
+				int32 DeferredCount = 0;
+				const double Start = FPlatformTime::Seconds();
+				for (int32 Frame = 0; Frame < Frames; ++Frame)
+				{
+					Scheduler->RunMachines(1.0f / 60.0f);
+					DeferredCount += Scheduler->GetLastFrameDeferredCount();
+				}
+				const double MsPerFrame = (FPlatformTime::Seconds() - Start) * 1000.0 / Frames;
+
+				UE_LOG(LogTemp, Log, TEXT("Coro.Scheduler.Benchmark %s %d machines: %.4f ms/frame, %.1f deferred/frame"),
+				       Mode == EMode::Serial ? TEXT("Serial") : Mode == EMode::Budgeted ? TEXT("Budgeted") : TEXT("Parallel"),
+				       NumMachines, MsPerFrame, static_cast<double>(DeferredCount) / Frames);
+
+				for (const auto& Machine : Machines)
+				{
+					Scheduler->UnregisterMachine(*Machine);
+					Machine->Destroy();
+				}
+				Scheduler->Deinitialize();
+				Scheduler->MarkAsGarbage();
+			}
+		}
+
+		BudgetVariable->SetWithCurrentPriority(PreviousBudgetMs);
+	}));
+
+#endif
@@ -0,0 +1,205 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Traversables/InstancedTraversableActor.h"
+
+#include "Components/HierarchicalInstancedStaticMeshComponent.h"
+#include "Components/StaticMeshComponent.h"
+#include "Engine/StaticMesh.h"
+#include "Engine/World.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformTime.h"
+#include "Math/RandomStream.h"
+#include "Serialization/ArchiveCountMem.h"
+
+AInstancedTraversableActor::AInstancedTraversableActor()
+{
+	InstancedMesh = CreateDefaultSubobject<UHierarchicalInstancedStaticMeshComponent>(TEXT("InstancedMesh"));
+	RootComponent = InstancedMesh;
+}
+
+FTransform AInstancedTraversableActor::GetLedgeSpaceForHit(const FHitResult& Hit) const
+{
+	FTransform InstanceTransform;
+	if (Hit.Component.Get() == InstancedMesh &&
+		InstancedMesh->GetInstanceTransform(Hit.Item, InstanceTransform, true))
+	{
+		return InstanceTransform;
+	}
+	return Super::GetLedgeSpaceForHit(Hit);
+}
+
+void AInstancedTraversableActor::GetLedgeInstances(TArray<FLedgeInstance>& OutInstances) const
+{
+	OutInstances.Reset();
+	if (!InstancedMesh)
+	{
+		return;
+	}
+
+	const int32 NumInstances = InstancedMesh->GetInstanceCount();
+	OutInstances.Reserve(NumInstances);
+	for (int32 Item = 0; Item < NumInstances; ++Item)
+	{
+		FLedgeInstance& Instance = OutInstances.AddDefaulted_GetRef();
+		InstancedMesh->GetInstanceTransform(Item, Instance.LedgeToWorld, true);
+		Instance.Item = Item;
+	}
+}
+
+SIZE_T AInstancedTraversableActor::GetInstanceAllocatedSize() const
+{
+	return InstancedMesh ? InstancedMesh->PerInstanceSMData.GetAllocatedSize() : 0;
+}
+
+#if !UE_BUILD_SHIPPING
+
+namespace
+{
+	//The four top edges of a box as ledges, with the edges across from each other as opposites.
+	void AddBoxLedges(ATraversableActor& Traversable, USceneComponent* Parent, const FVector& Center,
+	                  const FVector& Extent)
+	{
+		const FVector Corners[] = {
+			{-Extent.X, -Extent.Y, Extent.Z}, {Extent.X, -Extent.Y, Extent.Z},
+			{Extent.X, Extent.Y, Extent.Z}, {-Extent.X, Extent.Y, Extent.Z}
+		};
+
+		const int32 FirstLedge = Traversable.LedgeSplines.Num();
+		for (int32 i = 0; i < 4; ++i)
+		{
+			const auto Spline = NewObject<USplineComponent>(&Traversable);
+			Spline->SetupAttachment(Parent);
+			Spline->RegisterComponent();
+			Spline->SetSplinePoints(TArray<FVector>{Center + Corners[i], Center + Corners[(i + 1) % 4]},
+			                        ESplineCoordinateSpace::Local);
+			Traversable.LedgeSplines.Add(Spline);
+		}
+		for (int32 i = 0; i < 4; ++i)
+		{
+			Traversable.OppositeLedges.Add(Traversable.LedgeSplines[FirstLedge + i],
+			                               Traversable.LedgeSplines[FirstLedge + (i ^ 2)]);
+		}
+	}
+
+	SIZE_T GetActorBytes(AActor& Actor)
+	{
+		FArchiveCountMem ActorMem{&Actor};
+		SIZE_T Bytes = Actor.GetClass()->GetStructureSize() + ActorMem.GetMax();
+		for (const auto Component : Actor.GetComponents())
+		{
+			FArchiveCountMem ComponentMem{Component};
+			Bytes += Component->GetClass()->GetStructureSize() + ComponentMem.GetMax();
+		}
+		return Bytes;
+	}
+
+	//Random sweeps through the obstacle field, every hit on a traversable resolves its ledges like a traversal check.
+	double MeasureSweeps(UWorld* World, const double HalfSide, const int32 NumSweeps, int32& OutNumLedges)
+	{
+		FRandomStream Random{NumSweeps};
+		const auto Capsule = FCollisionShape::MakeCapsule(30.0f, 90.0f);
+
+		OutNumLedges = 0;
+		const double Start = FPlatformTime::Seconds();
+		for (int32 i = 0; i < NumSweeps; ++i)
+		{
+			const FVector TraceStart{Random.FRandRange(-HalfSide, HalfSide), Random.FRandRange(-HalfSide, HalfSide), 90.0};
+			const FVector TraceEnd = TraceStart + FRotator{0.0, Random.FRandRange(0.0, 360.0), 0.0}.Vector() * 200.0;
+
+			FHitResult Hit;
+			if (World->SweepSingleByChannel(Hit, TraceStart, TraceEnd, FQuat::Identity, ECC_Visibility, Capsule))
+			{
+				if (const auto Traversable = Cast<ATraversableActor>(Hit.GetActor()))
+				{
+					OutNumLedges += Traversable->GetLedgeTransformsForHit(Hit, TraceStart).bHasFrontLedge;
+				}
+			}
+		}
+		return (FPlatformTime::Seconds() - Start) * 1000.0;
+	}
+}
+
+//Lays the same field of one metre boxes out once as separate traversables and once as instances of one traversable.
+static FAutoConsoleCommandWithWorldAndArgs InstancedTraversableBenchmarkCommand(
+	TEXT("Parkour.InstancedTraversable.Benchmark"),
+	TEXT("Compares per-actor traversables against one instanced traversable. Usage: Parkour.InstancedTraversable.Benchmark [NumObstacles] [NumSweeps]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		const auto Cube = LoadObject<UStaticMesh>(nullptr, TEXT("/Engine/BasicShapes/Cube.Cube"));
+		if (!World || !Cube)
+		{
+			return;
+		}
+
+		const int32 NumObstacles = Args.Num() > 0 ? FMath::Max(1, FCString::Atoi(*Args[0])) : 1000;
+		const int32 NumSweeps = Args.Num() > 1 ? FMath::Max(1, FCString::Atoi(*Args[1])) : 10000;
+		const int32 GridSide = FMath::CeilToInt32(FMath::Sqrt(static_cast<float>(NumObstacles)));
+		const double Spacing = 300.0;
+		const double HalfSide = GridSide * Spacing / 2.0;
+		const FVector BoxCenter{0.0, 0.0, 50.0};
+		const FVector BoxExtent{50.0};
+
+		auto GetObstacleLocation = [&](const int32 i)
+		{
+			return FVector{i % GridSide * Spacing - HalfSide, i / GridSide * Spacing - HalfSide, 0.0};
+		};
+
+		FActorSpawnParameters SpawnParameters;
+		SpawnParameters.ObjectFlags = RF_Transient;
+
+		//One actor, one mesh component and four splines per obstacle.
+		TArray<ATraversableActor*> Actors;
+		SIZE_T ActorBytes = 0;
+		for (int32 i = 0; i < NumObstacles; ++i)
+		{
+			const auto Traversable = World->SpawnActor<ATraversableActor>(GetObstacleLocation(i), FRotator::ZeroRotator,
+			                                                              SpawnParameters);
+			const auto Mesh = NewObject<UStaticMeshComponent>(Traversable);
+			Mesh->SetStaticMesh(Cube);
+			Mesh->SetRelativeLocation(GetObstacleLocation(i) + BoxCenter);
+			Traversable->SetRootComponent(Mesh);
+			Mesh->RegisterComponent();
+			AddBoxLedges(*Traversable, Mesh, FVector::ZeroVector, BoxExtent);
+			Traversable->MarkLedgesChanged();
+			Traversable->BakeLedges();
+			Actors.Add(Traversable);
+			ActorBytes += GetActorBytes(*Traversable) + Traversable->GetLedgeData().GetAllocatedSize() +
+				Traversable->GetBakedLedgeAllocatedSize();
+		}
+
+		int32 ActorLedges = 0;
+		const double ActorSweepMs = MeasureSweeps(World, HalfSide, NumSweeps, ActorLedges);
+		for (const auto Traversable : Actors)
+		{
+			Traversable->Destroy();
+		}
+
+		//One actor, one instanced mesh and one set of template splines for the whole field.
+		const auto Instanced = World->SpawnActor<AInstancedTraversableActor>(FVector::ZeroVector, FRotator::ZeroRotator,
+		                                                                     SpawnParameters);
+		Instanced->InstancedMesh->SetStaticMesh(Cube);
+		AddBoxLedges(*Instanced, Instanced->InstancedMesh, FVector::ZeroVector, BoxExtent);
+		Instanced->MarkLedgesChanged();
+		for (int32 i = 0; i < NumObstacles; ++i)
+		{
+			Instanced->InstancedMesh->AddInstance(FTransform{GetObstacleLocation(i) + BoxCenter}, true);
+		}
+		Instanced->MarkInstancesChanged();
+		Instanced->BakeLedges();
+		const SIZE_T InstancedBytes = GetActorBytes(*Instanced) + Instanced->GetInstanceAllocatedSize() +
+			Instanced->GetLedgeData().GetAllocatedSize() + Instanced->GetBakedLedgeAllocatedSize();
+
+		int32 InstancedLedges = 0;
+		const double InstancedSweepMs = MeasureSweeps(World, HalfSide, NumSweeps, InstancedLedges);
+		Instanced->Destroy();
+
+		UE_LOG(LogTemp, Log,
+		       TEXT("Traversables, %d obstacles: per actor %d actors %.1f KiB, sweeps %.3f ms (%d ledges)"),
+		       NumObstacles, NumObstacles, ActorBytes / 1024.0, ActorSweepMs, ActorLedges);
+		UE_LOG(LogTemp, Log,
+		       TEXT("Traversables, %d obstacles: instanced 1 actor %.1f KiB, sweeps %.3f ms (%d ledges)"),
+		       NumObstacles, InstancedBytes / 1024.0, InstancedSweepMs, InstancedLedges);
+	}));
+
+#endif
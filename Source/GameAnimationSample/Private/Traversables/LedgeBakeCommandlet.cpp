@@ -0,0 +1,503 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Traversables/LedgeBakeCommandlet.h"
+
+#include "Components/InstancedStaticMeshComponent.h"
+#include "Components/StaticMeshComponent.h"
+#include "Engine/Level.h"
+#include "Engine/StaticMesh.h"
+#include "Engine/World.h"
+#include "HAL/PlatformTime.h"
+#include "Misc/Crc.h"
+#include "Misc/PackageName.h"
+#include "PhysicsEngine/BodySetup.h"
+#include "Traversables/TraversableActor.h"
+#include "UObject/Package.h"
+#include "UObject/SavePackage.h"
+
+ULedgeBakeCommandlet::ULedgeBakeCommandlet()
+{
+	IsClient = false;
+	IsEditor = true;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+#if WITH_EDITOR
+
+namespace
+{
+	//Bumped whenever the bake changes, so every actor is rebaked once.
+	constexpr uint32 LedgeBakeVersion = 1;
+
+	struct FLedgeBakeSettings
+	{
+		//Faces tilted further than this from up are walls rather than tops.
+		float MaxSlope{30.0f};
+		float MinLedgeLength{30.0f};
+		//Opposite ledges further apart in height than this aren't paired.
+		float MaxOppositeHeight{50.0f};
+	};
+
+	//A straight top edge in ledge space, Normal points horizontally away from the top.
+	struct FBakedLedge
+	{
+		FVector Start;
+		FVector End;
+		FVector Normal;
+	};
+
+	struct FMeshBakeTime
+	{
+		double Milliseconds{0.0};
+		int32 NumComponents{0};
+		int32 NumLedges{0};
+	};
+
+	//Finds the edges where an upward face meets a wall on one convex piece of collision.
+	void FindTopEdges(TConstArrayView<FVector> Vertices, TConstArrayView<int32> Indices, const FVector& Up,
+	                  const FLedgeBakeSettings& Settings, TArray<FBakedLedge>& OutLedges)
+	{
+		if (Vertices.IsEmpty() || Indices.Num() < 3)
+		{
+			return;
+		}
+
+		FVector Centroid = FVector::ZeroVector;
+		for (const auto& Vertex : Vertices)
+		{
+			Centroid += Vertex;
+		}
+		Centroid /= Vertices.Num();
+
+		struct FEdgeFaces
+		{
+			int32 NumTop{0};
+			int32 NumOther{0};
+			FVector TopCentroid{FVector::ZeroVector};
+		};
+		TMap<TPair<int32, int32>, FEdgeFaces> Edges;
+
+		const double CosMaxSlope = FMath::Cos(FMath::DegreesToRadians(Settings.MaxSlope));
+		for (int32 i = 0; i + 2 < Indices.Num(); i += 3)
+		{
+			const int32 Triangle[] = {Indices[i], Indices[i + 1], Indices[i + 2]};
+			const FVector& A = Vertices[Triangle[0]];
+			const FVector& B = Vertices[Triangle[1]];
+			const FVector& C = Vertices[Triangle[2]];
+			const FVector TriangleCentroid = (A + B + C) / 3.0;
+
+			FVector Normal = ((B - A) ^ (C - A)).GetSafeNormal();
+			if (Normal.IsNearlyZero())
+			{
+				continue;
+			}
+			//Winding isn't reliable across collision sources, on a convex piece outward is away from the centre.
+			if ((Normal | (TriangleCentroid - Centroid)) < 0.0)
+			{
+				Normal = -Normal;
+			}
+
+			const bool bTop = (Normal | Up) >= CosMaxSlope;
+			for (int32 Corner = 0; Corner < 3; ++Corner)
+			{
+				const int32 First = Triangle[Corner];
+				const int32 Second = Triangle[(Corner + 1) % 3];
+				auto& Faces = Edges.FindOrAdd({FMath::Min(First, Second), FMath::Max(First, Second)});
+				if (bTop)
+				{
+					++Faces.NumTop;
+					Faces.TopCentroid = TriangleCentroid;
+				}
+				else
+				{
+					++Faces.NumOther;
+				}
+			}
+		}
+
+		for (const auto& [Edge, Faces] : Edges)
+		{
+			//Edges between two top triangles are inside the top, edges with no top face are on the walls.
+			if (Faces.NumTop != 1)
+			{
+				continue;
+			}
+
+			FVector Start = Vertices[Edge.Key];
+			FVector End = Vertices[Edge.Value];
+			const FVector Direction = (End - Start).GetSafeNormal();
+			if (FMath::Abs(Direction | Up) > 0.5)
+			{
+				continue;
+			}
+
+			FVector Normal = FVector::VectorPlaneProject(Direction ^ Up, Up).GetSafeNormal();
+			if ((((Start + End) * 0.5 - Faces.TopCentroid) | Normal) < 0.0)
+			{
+				Normal = -Normal;
+			}
+			//Every ledge runs the same way around the top, which lets collinear pieces be chained.
+			if (((End - Start) | (Up ^ Normal)) < 0.0)
+			{
+				Swap(Start, End);
+			}
+			OutLedges.Add({Start, End, Normal});
+		}
+	}
+
+	//Joins collinear pieces that continue each other, like the two halves of a top split across triangles.
+	void MergeLedges(TArray<FBakedLedge>& Ledges)
+	{
+		constexpr double Tolerance = 0.5;
+		bool bMerged = true;
+		while (bMerged)
+		{
+			bMerged = false;
+			for (int32 i = 0; i < Ledges.Num() && !bMerged; ++i)
+			{
+				for (int32 j = 0; j < Ledges.Num(); ++j)
+				{
+					if (i == j || !Ledges[i].End.Equals(Ledges[j].Start, Tolerance) ||
+						(Ledges[i].Normal | Ledges[j].Normal) < 0.999 ||
+						((Ledges[i].End - Ledges[i].Start).GetSafeNormal() |
+							(Ledges[j].End - Ledges[j].Start).GetSafeNormal()) < 0.999)
+					{
+						continue;
+					}
+
+					Ledges[i].End = Ledges[j].End;
+					Ledges.RemoveAtSwap(j);
+					bMerged = true;
+					break;
+				}
+			}
+		}
+	}
+
+	//The nearest ledge behind this one that faces the other way and overlaps it along its length.
+	int32 FindOppositeLedge(const TArray<FBakedLedge>& Ledges, const int32 Index, const FVector& Up,
+	                        const FLedgeBakeSettings& Settings)
+	{
+		const auto& Ledge = Ledges[Index];
+		const FVector Direction = (Ledge.End - Ledge.Start).GetSafeNormal();
+		const double Length = (Ledge.End - Ledge.Start).Size();
+
+		int32 Opposite = INDEX_NONE;
+		double BestDepth = TNumericLimits<double>::Max();
+		for (int32 i = 0; i < Ledges.Num(); ++i)
+		{
+			const auto& Other = Ledges[i];
+			if (i == Index || (Ledge.Normal | Other.Normal) > -0.9)
+			{
+				continue;
+			}
+
+			const FVector Offset = (Other.Start + Other.End) * 0.5 - (Ledge.Start + Ledge.End) * 0.5;
+			const double Depth = -(Offset | Ledge.Normal);
+			const double OtherStart = (Other.Start - Ledge.Start) | Direction;
+			const double OtherEnd = (Other.End - Ledge.Start) | Direction;
+			if (Depth <= 0.0 || FMath::Abs(Offset | Up) > Settings.MaxOppositeHeight ||
+				FMath::Max(OtherStart, OtherEnd) < 0.0 || FMath::Min(OtherStart, OtherEnd) > Length)
+			{
+				continue;
+			}
+
+			if (Depth < BestDepth)
+			{
+				BestDepth = Depth;
+				Opposite = i;
+			}
+		}
+		return Opposite;
+	}
+
+	void PackLedges(const TArray<FBakedLedge>& Ledges, const FVector& Up, const float Spacing,
+	                const FLedgeBakeSettings& Settings, FCompactLedgeData& OutLedgeData)
+	{
+		OutLedgeData.Reset();
+		OutLedgeData.PointOffsets.Add(0);
+		for (int32 i = 0; i < Ledges.Num(); ++i)
+		{
+			const auto& Ledge = Ledges[i];
+			const float Length = (Ledge.End - Ledge.Start).Size();
+			const int32 NumSteps = FMath::Max(1, FMath::CeilToInt(Length / FMath::Max(Spacing, 1.0f)));
+
+			OutLedgeData.Lengths.Add(Length);
+			OutLedgeData.OppositeLedges.Add(FindOppositeLedge(Ledges, i, Up, Settings));
+			for (int32 Step = 0; Step <= NumSteps; ++Step)
+			{
+				//The spline up vector the ledges were authored with is the outward normal, baked ledges match it.
+				OutLedgeData.Points.Add(FVector3f{FMath::Lerp(Ledge.Start, Ledge.End, static_cast<double>(Step) / NumSteps)});
+				OutLedgeData.Ups.Add(FVector3f{Ledge.Normal});
+			}
+			OutLedgeData.PointOffsets.Add(OutLedgeData.Points.Num());
+		}
+	}
+
+	//Where a component's collision sits in the space the actor's packed ledges are in.
+	FTransform GetComponentToLedgeSpace(const ATraversableActor& Traversable, const UStaticMeshComponent& Component)
+	{
+		//An instanced traversable's ledges are a template around a single instance.
+		if (Component.IsA<UInstancedStaticMeshComponent>())
+		{
+			return FTransform::Identity;
+		}
+
+		//Loaded levels aren't registered, so walk the relative transforms up to the root.
+		FTransform ComponentToActor = FTransform::Identity;
+		for (const USceneComponent* Current = &Component; Current && Current != Traversable.GetRootComponent();
+		     Current = Current->GetAttachParent())
+		{
+			ComponentToActor = ComponentToActor * Current->GetRelativeTransform();
+		}
+		return ComponentToActor;
+	}
+
+	uint32 HashTransform(const FTransform& Transform, const uint32 Crc)
+	{
+		const FVector Translation = Transform.GetTranslation();
+		const FQuat Rotation = Transform.GetRotation();
+		const FVector Scale = Transform.GetScale3D();
+		const double Values[] = {
+			Translation.X, Translation.Y, Translation.Z, Rotation.X, Rotation.Y, Rotation.Z, Rotation.W,
+			Scale.X, Scale.Y, Scale.Z
+		};
+		return FCrc::MemCrc32(Values, sizeof(Values), Crc);
+	}
+
+	//Covers everything the bake reads, so an unchanged hash means an unchanged result.
+	uint32 HashLedgeSources(const ATraversableActor& Traversable, const FVector& Up, const FLedgeBakeSettings& Settings)
+	{
+		uint32 Crc = FCrc::MemCrc32(&LedgeBakeVersion, sizeof(LedgeBakeVersion));
+		Crc = FCrc::MemCrc32(&Settings, sizeof(Settings), Crc);
+		Crc = FCrc::MemCrc32(&Traversable.LedgeBakeSpacing, sizeof(Traversable.LedgeBakeSpacing), Crc);
+		const double UpValues[] = {Up.X, Up.Y, Up.Z};
+		Crc = FCrc::MemCrc32(UpValues, sizeof(UpValues), Crc);
+
+		Traversable.ForEachComponent<UStaticMeshComponent>(false, [&](const UStaticMeshComponent* Component)
+		{
+			const auto Mesh = Component->GetStaticMesh();
+			const auto BodySetup = Mesh ? Mesh->GetBodySetup() : nullptr;
+			if (!BodySetup)
+			{
+				return;
+			}
+			Crc = FCrc::StrCrc32(*Mesh->GetPathName(), Crc);
+			Crc = FCrc::MemCrc32(&BodySetup->BodySetupGuid, sizeof(FGuid), Crc);
+			Crc = HashTransform(GetComponentToLedgeSpace(Traversable, *Component), Crc);
+		});
+		return Crc;
+	}
+
+	void GatherComponentLedges(const UStaticMeshComponent& Component, const FTransform& ComponentToLedgeSpace,
+	                           const FVector& Up, const FLedgeBakeSettings& Settings, TArray<FBakedLedge>& OutLedges)
+	{
+		const auto BodySetup = Component.GetStaticMesh()->GetBodySetup();
+		const auto& AggGeom = BodySetup->AggGeom;
+
+		TArray<FVector> Vertices;
+		for (const auto& Box : AggGeom.BoxElems)
+		{
+			const FTransform BoxToLedgeSpace = Box.GetTransform() * ComponentToLedgeSpace;
+			const FVector Extent{Box.X * 0.5, Box.Y * 0.5, Box.Z * 0.5};
+			Vertices.Reset(8);
+			for (int32 Corner = 0; Corner < 8; ++Corner)
+			{
+				Vertices.Add(BoxToLedgeSpace.TransformPosition(FVector{
+					Corner & 1 ? Extent.X : -Extent.X, Corner & 2 ? Extent.Y : -Extent.Y, Corner & 4 ? Extent.Z : -Extent.Z
+				}));
+			}
+
+			//Each face is a quad of corners in order around it, split in two.
+			static constexpr int32 BoxIndices[] = {
+				0, 2, 6, 0, 6, 4, 1, 3, 7, 1, 7, 5, 0, 1, 5, 0, 5, 4,
+				2, 3, 7, 2, 7, 6, 0, 1, 3, 0, 3, 2, 4, 5, 7, 4, 7, 6
+			};
+			FindTopEdges(Vertices, BoxIndices, Up, Settings, OutLedges);
+		}
+
+		for (const auto& Convex : AggGeom.ConvexElems)
+		{
+			if (Convex.IndexData.IsEmpty())
+			{
+				UE_LOG(LogTemp, Verbose, TEXT("Ledge bake: a convex of %s has no triangles, skipped."),
+				       *Component.GetStaticMesh()->GetPathName());
+				continue;
+			}
+
+			const FTransform ConvexToLedgeSpace = Convex.GetTransform() * ComponentToLedgeSpace;
+			Vertices.Reset(Convex.VertexData.Num());
+			for (const auto& Vertex : Convex.VertexData)
+			{
+				Vertices.Add(ConvexToLedgeSpace.TransformPosition(Vertex));
+			}
+			FindTopEdges(Vertices, Convex.IndexData, Up, Settings, OutLedges);
+		}
+	}
+
+	//Returns true if the actor's ledges were rebaked.
+	bool BakeTraversable(ATraversableActor& Traversable, const FLedgeBakeSettings& Settings, const bool bForce,
+	                     TMap<FString, FMeshBakeTime>& InOutMeshTimes)
+	{
+		//Ledges are found in the space they're packed in, which may be rotated away from the world.
+		const auto Root = Traversable.GetRootComponent();
+		const FVector Up = Root && !Root->IsA<UInstancedStaticMeshComponent>()
+			                   ? Root->GetRelativeRotation().Quaternion().UnrotateVector(FVector::UpVector)
+			                   : FVector::UpVector;
+
+		const uint32 SourceHash = HashLedgeSources(Traversable, Up, Settings);
+		if (!bForce && Traversable.AreLedgesBakedFromCollision() && Traversable.GetBakedLedgeSourceHash() == SourceHash)
+		{
+			return false;
+		}
+
+		TArray<FBakedLedge> Ledges;
+		Traversable.ForEachComponent<UStaticMeshComponent>(false, [&](const UStaticMeshComponent* Component)
+		{
+			const auto Mesh = Component->GetStaticMesh();
+			if (!Mesh || !Mesh->GetBodySetup())
+			{
+				return;
+			}
+
+			const double Start = FPlatformTime::Seconds();
+			const int32 NumLedgesBefore = Ledges.Num();
+			GatherComponentLedges(*Component, GetComponentToLedgeSpace(Traversable, *Component), Up, Settings, Ledges);
+
+			auto& MeshTime = InOutMeshTimes.FindOrAdd(Mesh->GetPathName());
+			MeshTime.Milliseconds += (FPlatformTime::Seconds() - Start) * 1000.0;
+			++MeshTime.NumComponents;
+			MeshTime.NumLedges += Ledges.Num() - NumLedgesBefore;
+		});
+
+		MergeLedges(Ledges);
+		Ledges.RemoveAll([&Settings](const FBakedLedge& Ledge)
+		{
+			return FVector::Dist(Ledge.Start, Ledge.End) < Settings.MinLedgeLength;
+		});
+
+		FCompactLedgeData LedgeData;
+		PackLedges(Ledges, Up, Traversable.LedgeBakeSpacing, Settings, LedgeData);
+		Traversable.SetBakedLedgeData(MoveTemp(LedgeData), SourceHash);
+		Traversable.MarkPackageDirty();
+		return true;
+	}
+
+	bool SavePackage(UPackage* Package, UWorld* World)
+	{
+		//One file per actor levels keep each actor in its own package.
+		const bool bIsMap = Package == World->GetOutermost();
+		const FString Filename = FPackageName::LongPackageNameToFilename(
+			Package->GetName(),
+			bIsMap ? FPackageName::GetMapPackageExtension() : FPackageName::GetAssetPackageExtension());
+
+		FSavePackageArgs SaveArgs;
+		SaveArgs.TopLevelFlags = RF_Standalone;
+		SaveArgs.Error = GError;
+		return UPackage::SavePackage(Package, bIsMap ? World : nullptr, *Filename, SaveArgs);
+	}
+}
+
+int32 ULedgeBakeCommandlet::Main(const FString& Params)
+{
+	TArray<FString> Tokens;
+	TArray<FString> Switches;
+	TMap<FString, FString> ParamValues;
+	ParseCommandLine(*Params, Tokens, Switches, ParamValues);
+
+	TArray<FString> Maps;
+	ParamValues.FindRef(TEXT("Map")).ParseIntoArray(Maps, TEXT(","));
+	if (Maps.IsEmpty())
+	{
+		UE_LOG(LogTemp, Error, TEXT("Ledge bake: no maps given, use -Map=/Game/Path/To/Map[,...]"));
+		return 1;
+	}
+
+	const bool bForce = Switches.Contains(TEXT("Force"));
+	FLedgeBakeSettings Settings;
+	if (const auto MaxSlope = ParamValues.Find(TEXT("MaxSlope")))
+	{
+		Settings.MaxSlope = FCString::Atof(**MaxSlope);
+	}
+	if (const auto MinLedgeLength = ParamValues.Find(TEXT("MinLedgeLength")))
+	{
+		Settings.MinLedgeLength = FCString::Atof(**MinLedgeLength);
+	}
+	if (const auto MaxOppositeHeight = ParamValues.Find(TEXT("MaxOppositeHeight")))
+	{
+		Settings.MaxOppositeHeight = FCString::Atof(**MaxOppositeHeight);
+	}
+
+	int32 Result = 0;
+	TMap<FString, FMeshBakeTime> MeshTimes;
+	for (const auto& Map : Maps)
+	{
+		const double MapStart = FPlatformTime::Seconds();
+		const auto Package = LoadPackage(nullptr, *Map, LOAD_None);
+		const auto World = Package ? UWorld::FindWorldInPackage(Package) : nullptr;
+		if (!World || !World->PersistentLevel)
+		{
+			UE_LOG(LogTemp, Error, TEXT("Ledge bake: couldn't load %s."), *Map);
+			Result = 1;
+			continue;
+		}
+
+		int32 NumBaked = 0;
+		int32 NumSkipped = 0;
+		TSet<UPackage*> DirtyPackages;
+		for (const auto Actor : World->PersistentLevel->Actors)
+		{
+			const auto Traversable = Cast<ATraversableActor>(Actor);
+			if (!Traversable)
+			{
+				continue;
+			}
+
+			if (BakeTraversable(*Traversable, Settings, bForce, MeshTimes))
+			{
+				++NumBaked;
+				DirtyPackages.Add(Traversable->GetPackage());
+			}
+			else
+			{
+				++NumSkipped;
+			}
+		}
+
+		for (const auto DirtyPackage : DirtyPackages)
+		{
+			if (!SavePackage(DirtyPackage, World))
+			{
+				UE_LOG(LogTemp, Error, TEXT("Ledge bake: couldn't save %s."), *DirtyPackage->GetName());
+				Result = 1;
+			}
+		}
+
+		UE_LOG(LogTemp, Display, TEXT("Ledge bake: %s, %d traversables baked, %d unchanged, %.1f ms."), *Map,
+		       NumBaked, NumSkipped, (FPlatformTime::Seconds() - MapStart) * 1000.0);
+	}
+
+	MeshTimes.ValueSort([](const FMeshBakeTime& A, const FMeshBakeTime& B)
+	{
+		return A.Milliseconds > B.Milliseconds;
+	});
+	for (const auto& [Mesh, Time] : MeshTimes)
+	{
+		UE_LOG(LogTemp, Display, TEXT("Ledge bake: %8.3f ms  %4d components  %4d edges  %s"), Time.Milliseconds,
+		       Time.NumComponents, Time.NumLedges, *Mesh);
+	}
+
+	return Result;
+}
+
+#else
+
+int32 ULedgeBakeCommandlet::Main(const FString& Params)
+{
+	UE_LOG(LogTemp, Error, TEXT("Ledge bake needs an editor build."));
+	return 1;
+}
+
+#endif
@@ -0,0 +1,213 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Traversables/LedgeSegmentLanes.h"
+
+#include "Math/VectorRegister.h"
+
+namespace
+{
+	constexpr int32 NumLanes = 4;
+
+	//Squared distance from the points to the segments lane by lane, with where along the segments they're closest.
+	FORCEINLINE VectorRegister4Float SquaredDistanceToSegments(
+		const VectorRegister4Float& PointX, const VectorRegister4Float& PointY, const VectorRegister4Float& PointZ,
+		const VectorRegister4Float& StartX, const VectorRegister4Float& StartY, const VectorRegister4Float& StartZ,
+		const VectorRegister4Float& DirectionX, const VectorRegister4Float& DirectionY,
+		const VectorRegister4Float& DirectionZ, const VectorRegister4Float& InvLengthSquared,
+		VectorRegister4Float& OutAlpha)
+	{
+		const VectorRegister4Float ToPointX = VectorSubtract(PointX, StartX);
+		const VectorRegister4Float ToPointY = VectorSubtract(PointY, StartY);
+		const VectorRegister4Float ToPointZ = VectorSubtract(PointZ, StartZ);
+
+		const VectorRegister4Float Projection = VectorMultiplyAdd(
+			ToPointZ, DirectionZ, VectorMultiplyAdd(ToPointY, DirectionY, VectorMultiply(ToPointX, DirectionX)));
+		OutAlpha = VectorMin(VectorMax(VectorMultiply(Projection, InvLengthSquared), VectorZeroFloat()),
+		                     VectorOneFloat());
+
+		const VectorRegister4Float OffsetX = VectorNegateMultiplyAdd(DirectionX, OutAlpha, ToPointX);
+		const VectorRegister4Float OffsetY = VectorNegateMultiplyAdd(DirectionY, OutAlpha, ToPointY);
+		const VectorRegister4Float OffsetZ = VectorNegateMultiplyAdd(DirectionZ, OutAlpha, ToPointZ);
+		return VectorMultiplyAdd(OffsetZ, OffsetZ, VectorMultiplyAdd(OffsetY, OffsetY, VectorMultiply(OffsetX, OffsetX)));
+	}
+}
+
+void FLedgeSegmentLanes::Reset()
+{
+	StartX.Reset();
+	StartY.Reset();
+	StartZ.Reset();
+	DirectionX.Reset();
+	DirectionY.Reset();
+	DirectionZ.Reset();
+	InvLengthSquared.Reset();
+	NumSegments = 0;
+}
+
+void FLedgeSegmentLanes::Reserve(const int32 InNum)
+{
+	for (auto Lane : {&StartX, &StartY, &StartZ, &DirectionX, &DirectionY, &DirectionZ, &InvLengthSquared})
+	{
+		Lane->Reserve(InNum + NumLanes - 1);
+	}
+}
+
+void FLedgeSegmentLanes::Add(const FVector3f& Start, const FVector3f& End)
+{
+	//Padding from an earlier Pad would sit between the segments.
+	check(StartX.Num() == NumSegments);
+
+	const FVector3f Direction = End - Start;
+	const float LengthSquared = Direction.SizeSquared();
+	StartX.Add(Start.X);
+	StartY.Add(Start.Y);
+	StartZ.Add(Start.Z);
+	DirectionX.Add(Direction.X);
+	DirectionY.Add(Direction.Y);
+	DirectionZ.Add(Direction.Z);
+	InvLengthSquared.Add(LengthSquared > UE_SMALL_NUMBER ? 1.0f / LengthSquared : 0.0f);
+	++NumSegments;
+}
+
+void FLedgeSegmentLanes::Pad()
+{
+	for (auto Lane : {&StartX, &StartY, &StartZ, &DirectionX, &DirectionY, &DirectionZ, &InvLengthSquared})
+	{
+		Lane->SetNumZeroed(NumSegments + NumLanes - 1);
+	}
+}
+
+SIZE_T FLedgeSegmentLanes::GetAllocatedSize() const
+{
+	return StartX.GetAllocatedSize() + StartY.GetAllocatedSize() + StartZ.GetAllocatedSize() +
+		DirectionX.GetAllocatedSize() + DirectionY.GetAllocatedSize() + DirectionZ.GetAllocatedSize() +
+		InvLengthSquared.GetAllocatedSize();
+}
+
+FVector3f FLedgeSegmentLanes::GetLocation(const FLedgeSegmentHit& Hit) const
+{
+	const int32 Segment = Hit.Segment;
+	return FVector3f{StartX[Segment], StartY[Segment], StartZ[Segment]} +
+		FVector3f{DirectionX[Segment], DirectionY[Segment], DirectionZ[Segment]} * Hit.Alpha;
+}
+
+void FLedgeSegmentLanes::FindClosest(const int32 First, const int32 Count, const FVector3f& Point,
+                                     FLedgeSegmentHit& InOutHit) const
+{
+	checkSlow(First >= 0 && First + Count <= NumSegments);
+	if (Count <= 0)
+	{
+		return;
+	}
+
+	const VectorRegister4Float PointX = VectorSetFloat1(Point.X);
+	const VectorRegister4Float PointY = VectorSetFloat1(Point.Y);
+	const VectorRegister4Float PointZ = VectorSetFloat1(Point.Z);
+	const VectorRegister4Float LaneOffsets = MakeVectorRegisterFloat(0.0f, 1.0f, 2.0f, 3.0f);
+	//Segment indices are carried as floats, exact far beyond any traversable's segment count.
+	const VectorRegister4Float End = VectorSetFloat1(static_cast<float>(First + Count));
+
+	VectorRegister4Float BestDistanceSquared = VectorSetFloat1(InOutHit.DistanceSquared);
+	VectorRegister4Float BestSegment = VectorSetFloat1(-1.0f);
+	VectorRegister4Float BestAlpha = VectorZeroFloat();
+	for (int32 i = First; i < First + Count; i += NumLanes)
+	{
+		VectorRegister4Float Alpha;
+		const VectorRegister4Float DistanceSquared = SquaredDistanceToSegments(
+			PointX, PointY, PointZ,
+			VectorLoad(StartX.GetData() + i), VectorLoad(StartY.GetData() + i), VectorLoad(StartZ.GetData() + i),
+			VectorLoad(DirectionX.GetData() + i), VectorLoad(DirectionY.GetData() + i),
+			VectorLoad(DirectionZ.GetData() + i), VectorLoad(InvLengthSquared.GetData() + i), Alpha);
+
+		//Lanes past the end of the range read padding or the next leaf's segments.
+		const VectorRegister4Float Segment = VectorAdd(VectorSetFloat1(static_cast<float>(i)), LaneOffsets);
+		const VectorRegister4Float Closer = VectorBitwiseAnd(VectorCompareLT(DistanceSquared, BestDistanceSquared),
+		                                                     VectorCompareLT(Segment, End));
+		BestDistanceSquared = VectorSelect(Closer, DistanceSquared, BestDistanceSquared);
+		BestSegment = VectorSelect(Closer, Segment, BestSegment);
+		BestAlpha = VectorSelect(Closer, Alpha, BestAlpha);
+	}
+
+	float Distances[NumLanes];
+	float Segments[NumLanes];
+	float Alphas[NumLanes];
+	VectorStore(BestDistanceSquared, Distances);
+	VectorStore(BestSegment, Segments);
+	VectorStore(BestAlpha, Alphas);
+	for (int32 Lane = 0; Lane < NumLanes; ++Lane)
+	{
+		if (Segments[Lane] >= 0.0f && Distances[Lane] < InOutHit.DistanceSquared)
+		{
+			InOutHit.DistanceSquared = Distances[Lane];
+			InOutHit.Segment = static_cast<int32>(Segments[Lane]);
+			InOutHit.Alpha = Alphas[Lane];
+		}
+	}
+}
+
+void FLedgeSegmentLanes::FindClosestBatch(const int32 First, const int32 Count, TConstArrayView<FVector3f> Points,
+                                          TArrayView<FLedgeSegmentHit> InOutHits) const
+{
+	checkSlow(First >= 0 && First + Count <= NumSegments);
+	check(Points.Num() == InOutHits.Num());
+	if (Count <= 0)
+	{
+		return;
+	}
+
+	for (int32 FirstPoint = 0; FirstPoint < Points.Num(); FirstPoint += NumLanes)
+	{
+		//A short last group repeats its last point, the extra lanes are dropped at the end.
+		const int32 NumPoints = FMath::Min(NumLanes, Points.Num() - FirstPoint);
+		float X[NumLanes];
+		float Y[NumLanes];
+		float Z[NumLanes];
+		float Distances[NumLanes];
+		for (int32 Lane = 0; Lane < NumLanes; ++Lane)
+		{
+			const int32 PointIndex = FirstPoint + FMath::Min(Lane, NumPoints - 1);
+			X[Lane] = Points[PointIndex].X;
+			Y[Lane] = Points[PointIndex].Y;
+			Z[Lane] = Points[PointIndex].Z;
+			Distances[Lane] = InOutHits[PointIndex].DistanceSquared;
+		}
+
+		const VectorRegister4Float PointX = VectorLoad(X);
+		const VectorRegister4Float PointY = VectorLoad(Y);
+		const VectorRegister4Float PointZ = VectorLoad(Z);
+		VectorRegister4Float BestDistanceSquared = VectorLoad(Distances);
+		VectorRegister4Float BestSegment = VectorSetFloat1(-1.0f);
+		VectorRegister4Float BestAlpha = VectorZeroFloat();
+		for (int32 i = First; i < First + Count; ++i)
+		{
+			VectorRegister4Float Alpha;
+			const VectorRegister4Float DistanceSquared = SquaredDistanceToSegments(
+				PointX, PointY, PointZ,
+				VectorSetFloat1(StartX[i]), VectorSetFloat1(StartY[i]), VectorSetFloat1(StartZ[i]),
+				VectorSetFloat1(DirectionX[i]), VectorSetFloat1(DirectionY[i]), VectorSetFloat1(DirectionZ[i]),
+				VectorSetFloat1(InvLengthSquared[i]), Alpha);
+
+			const VectorRegister4Float Closer = VectorCompareLT(DistanceSquared, BestDistanceSquared);
+			BestDistanceSquared = VectorSelect(Closer, DistanceSquared, BestDistanceSquared);
+			BestSegment = VectorSelect(Closer, VectorSetFloat1(static_cast<float>(i)), BestSegment);
+			BestAlpha = VectorSelect(Closer, Alpha, BestAlpha);
+		}
+
+		float Segments[NumLanes];
+		float Alphas[NumLanes];
+		VectorStore(BestDistanceSquared, Distances);
+		VectorStore(BestSegment, Segments);
+		VectorStore(BestAlpha, Alphas);
+		for (int32 Lane = 0; Lane < NumPoints; ++Lane)
+		{
+			if (Segments[Lane] >= 0.0f)
+			{
+				auto& Hit = InOutHits[FirstPoint + Lane];
+				Hit.DistanceSquared = Distances[Lane];
+				Hit.Segment = static_cast<int32>(Segments[Lane]);
+				Hit.Alpha = Alphas[Lane];
+			}
+		}
+	}
+}
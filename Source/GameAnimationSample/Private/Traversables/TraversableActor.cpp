@@ -2,66 +2,819 @@
 
 
 #include "Traversables/TraversableActor.h"
+#include "Algo/Sort.h"
+#include "Engine/World.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformTime.h"
+#include "EngineUtils.h"
+#include "Math/RandomStream.h"
+#include "Serialization/ArchiveCountMem.h"
+#include "Traversables/TraversableLedgeSubsystem.h"
+#include "UObject/ObjectSaveContext.h"
 
-USplineComponent* ATraversableActor::FindClosestLedgeToLocation(const FVector& Location)
+namespace
+{
+	//Small leaves keep the tree shallow, a traversable rarely has more than a few hundred segments.
+	constexpr int32 MaxSegmentsPerLeaf = 4;
+	//The closest ledge is measured from a point this far above the spline.
+	constexpr float LedgeUpOffset = 10.0f;
+	//Nothing further than this counts as close to a ledge.
+	constexpr float MaxLedgeDistanceSquared = 99999.f * 99999.f;
+	//Query points searched together in the batched closest ledge search.
+	constexpr int32 LedgeQueryPacketSize = 4;
+}
+
+void FCompactLedgeData::Reset()
+{
+	PointOffsets.Reset();
+	Lengths.Reset();
+	Points.Reset();
+	Ups.Reset();
+	OppositeLedges.Reset();
+}
+
+SIZE_T FCompactLedgeData::GetAllocatedSize() const
+{
+	return PointOffsets.GetAllocatedSize() + Lengths.GetAllocatedSize() + Points.GetAllocatedSize() +
+		Ups.GetAllocatedSize() + OppositeLedges.GetAllocatedSize();
+}
+
+void FCompactLedgeData::Evaluate(const int32 Ledge, const float Distance, FVector3f& OutLocation,
+                                 FVector3f& OutUp) const
+{
+	const int32 First = GetFirstPoint(Ledge);
+	const int32 NumPoints = GetNumPoints(Ledge);
+	check(NumPoints > 0);
+
+	const float Step = GetStep(Ledge);
+	const float Position = FMath::Clamp(Step > 0.0f ? Distance / Step : 0.0f, 0.0f, static_cast<float>(NumPoints - 1));
+	const int32 Index = FMath::Min(FMath::FloorToInt32(Position), NumPoints - 2);
+	if (Index < 0)
+	{
+		OutLocation = Points[First];
+		OutUp = Ups[First];
+		return;
+	}
+
+	const float Alpha = Position - Index;
+	OutLocation = FMath::Lerp(Points[First + Index], Points[First + Index + 1], Alpha);
+	OutUp = FMath::Lerp(Ups[First + Index], Ups[First + Index + 1], Alpha).GetSafeNormal(UE_SMALL_NUMBER,
+		Ups[First + Index]);
+}
+
+float FCompactLedgeData::FindDistanceClosestToLocation(const int32 Ledge, const FVector3f& Location) const
+{
+	const int32 First = GetFirstPoint(Ledge);
+	const int32 NumPoints = GetNumPoints(Ledge);
+	const float Step = GetStep(Ledge);
+
+	float BestDistanceSquared = TNumericLimits<float>::Max();
+	float BestDistance = 0.0f;
+	for (int32 i = 0; i + 1 < NumPoints; ++i)
+	{
+		const FVector3f& Start = Points[First + i];
+		const FVector3f Direction = Points[First + i + 1] - Start;
+		const float LengthSquared = Direction.SizeSquared();
+		const float Alpha = LengthSquared > UE_SMALL_NUMBER
+			                    ? FMath::Clamp(((Location - Start) | Direction) / LengthSquared, 0.0f, 1.0f)
+			                    : 0.0f;
+		const float DistanceSquared = FVector3f::DistSquared(Location, Start + Direction * Alpha);
+		if (DistanceSquared < BestDistanceSquared)
+		{
+			BestDistanceSquared = DistanceSquared;
+			BestDistance = (i + Alpha) * Step;
+		}
+	}
+	return BestDistance;
+}
+
+FLedgeCorrespondenceSample FLedgeCorrespondence::Evaluate(const float DistanceAlongFront) const
+{
+	check(HasOppositeLedge());
+	const float Position = FMath::Clamp(SampleStep > 0.0f ? DistanceAlongFront / SampleStep : 0.0f, 0.0f,
+	                                    static_cast<float>(Samples.Num() - 1));
+	const int32 Index = FMath::Min(FMath::FloorToInt32(Position), Samples.Num() - 2);
+	if (Index < 0)
+	{
+		return Samples[0];
+	}
+
+	const auto& A = Samples[Index];
+	const auto& B = Samples[Index + 1];
+	const float Alpha = Position - Index;
+
+	FLedgeCorrespondenceSample Sample;
+	Sample.BackLocation = FMath::Lerp(A.BackLocation, B.BackLocation, Alpha);
+	Sample.BackNormal = FMath::Lerp(A.BackNormal, B.BackNormal, Alpha).GetSafeNormal(UE_SMALL_NUMBER, A.BackNormal);
+	Sample.Depth = FMath::Lerp(A.Depth, B.Depth, Alpha);
+	return Sample;
+}
+
+void ATraversableActor::OnConstruction(const FTransform& Transform)
+{
+	Super::OnConstruction(Transform);
+	MarkLedgesChanged();
+}
+
+void ATraversableActor::BeginPlay()
+{
+	Super::BeginPlay();
+	//Levels saved before the ledges were packed, or actors spawned at runtime, build them now.
+	if (LedgeData.IsEmpty() && !LedgeSplines.IsEmpty())
+	{
+		BuildLedgeData();
+	}
+
+	if (bDiscardLedgeSplinesAtRuntime)
+	{
+		for (const auto Spline : LedgeSplines)
+		{
+			if (Spline)
+			{
+				Spline->DestroyComponent();
+			}
+		}
+		LedgeSplines.Reset();
+		OppositeLedges.Reset();
+		bLedgeSplinesDiscarded = true;
+	}
+
+	//Bake up front so the first query doesn't pay for it, possibly on a worker.
+	BakeLedges();
+
+	if (const auto LedgeSubsystem = GetWorld()->GetSubsystem<UTraversableLedgeSubsystem>())
+	{
+		LedgeSubsystem->RegisterTraversable(this);
+	}
+}
+
+void ATraversableActor::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (const auto LedgeSubsystem = GetWorld()->GetSubsystem<UTraversableLedgeSubsystem>())
+	{
+		LedgeSubsystem->UnregisterTraversable(this);
+	}
+	Super::EndPlay(EndPlayReason);
+}
+
+#if WITH_EDITOR
+void ATraversableActor::PreSave(FObjectPreSaveContext ObjectSaveContext)
+{
+	Super::PreSave(ObjectSaveContext);
+	//Covers splines edited after the last construction, cooked levels ship with the packed ledges.
+	BuildLedgeData();
+}
+#endif
+
+void ATraversableActor::MarkLedgesChanged()
+{
+	//Once the splines are gone the packed ledges are the only copy left.
+	if (!bLedgeSplinesDiscarded)
+	{
+		BuildLedgeData();
+	}
+	NotifyLedgesChanged();
+}
+
+void ATraversableActor::NotifyLedgesChanged()
+{
+	++LedgeVersion;
+
+	const auto World = GetWorld();
+	if (HasActorBegunPlay() && World)
+	{
+		if (const auto LedgeSubsystem = World->GetSubsystem<UTraversableLedgeSubsystem>())
+		{
+			LedgeSubsystem->UpdateTraversable(this);
+		}
+	}
+}
+
+void ATraversableActor::GetLedgeSegments(TArray<FLedgeSegment>& OutSegments) const
+{
+	BakeLedges();
+
+	FReadScopeLock ReadLock(LedgeIndexLock);
+	OutSegments = LedgeSegments;
+}
+
+void ATraversableActor::BakeLedges() const
+{
+	{
+		FReadScopeLock ReadLock(LedgeIndexLock);
+		if (BakedLedgeVersion == LedgeVersion)
+		{
+			return;
+		}
+	}
+
+	FWriteScopeLock WriteLock(LedgeIndexLock);
+	//Another thread may have baked while we waited for the lock.
+	if (BakedLedgeVersion != LedgeVersion)
+	{
+		BakeLedgesLocked();
+	}
+}
+
+void ATraversableActor::BuildLedgeData()
+{
+	if (bLedgesBakedFromCollision)
+	{
+		return;
+	}
+
+	FCompactLedgeData NewLedgeData;
+	NewLedgeData.PointOffsets.Add(0);
+
+	const FTransform& ActorTransform = GetActorTransform();
+	const float Spacing = FMath::Max(LedgeBakeSpacing, 1.0f);
+
+	for (USplineComponent* Spline : LedgeSplines)
+	{
+		//A missing spline keeps its slot, so ledge indices still match LedgeSplines.
+		const float Length = Spline ? Spline->GetSplineLength() : 0.0f;
+		const auto OppositeLedge = Spline ? OppositeLedges.FindRef(Spline) : nullptr;
+		NewLedgeData.Lengths.Add(Length);
+		NewLedgeData.OppositeLedges.Add(OppositeLedge ? LedgeSplines.IndexOfByKey(OppositeLedge) : INDEX_NONE);
+		if (Spline)
+		{
+			const int32 NumSteps = FMath::Max(1, FMath::CeilToInt(Length / Spacing));
+			for (int32 Step = 0; Step <= NumSteps; ++Step)
+			{
+				const float Distance = Length * Step / NumSteps;
+				NewLedgeData.Points.Add(FVector3f{
+					ActorTransform.InverseTransformPosition(
+						Spline->GetLocationAtDistanceAlongSpline(Distance, ESplineCoordinateSpace::World))
+				});
+				NewLedgeData.Ups.Add(FVector3f{
+					ActorTransform.InverseTransformVectorNoScale(
+						Spline->GetUpVectorAtDistanceAlongSpline(Distance, ESplineCoordinateSpace::World))
+				});
+			}
+		}
+		NewLedgeData.PointOffsets.Add(NewLedgeData.Points.Num());
+	}
+
+	//Queries on workers read LedgeData under the same lock.
+	FWriteScopeLock WriteLock(LedgeIndexLock);
+	LedgeData = MoveTemp(NewLedgeData);
+}
+
+void ATraversableActor::SetBakedLedgeData(FCompactLedgeData&& InLedgeData, const uint32 SourceHash)
+{
+	{
+		FWriteScopeLock WriteLock(LedgeIndexLock);
+		LedgeData = MoveTemp(InLedgeData);
+	}
+	bLedgesBakedFromCollision = true;
+	BakedLedgeSourceHash = SourceHash;
+	NotifyLedgesChanged();
+}
+
+SIZE_T ATraversableActor::GetBakedLedgeAllocatedSize() const
+{
+	FReadScopeLock ReadLock(LedgeIndexLock);
+	SIZE_T Size = LedgeSegments.GetAllocatedSize() + LedgeBVH.GetAllocatedSize() +
+		LedgeSegmentLanes.GetAllocatedSize() + LedgePointLanes.GetAllocatedSize() +
+		LedgeCorrespondences.GetAllocatedSize();
+	for (const auto& Correspondence : LedgeCorrespondences)
+	{
+		Size += Correspondence.Samples.GetAllocatedSize();
+	}
+	return Size;
+}
+
+SIZE_T ATraversableActor::GetLedgeSplineAllocatedSize() const
+{
+	SIZE_T Size = OppositeLedges.GetAllocatedSize() + LedgeSplines.GetAllocatedSize();
+	for (const auto Spline : LedgeSplines)
+	{
+		if (Spline)
+		{
+			FArchiveCountMem CountMem{Spline};
+			Size += Spline->GetClass()->GetStructureSize() + CountMem.GetMax();
+		}
+	}
+	return Size;
+}
+
+void ATraversableActor::BakeLedgesLocked() const
+{
+	LedgeSegments.Reset();
+	LedgeBVH.Reset();
+	LedgeSegmentLanes.Reset();
+	LedgePointLanes.Reset();
+	LedgeCorrespondences.Reset();
+	LedgeCorrespondences.SetNum(LedgeData.Num());
+
+	//Everything stays in actor space, so moving the actor doesn't invalidate it.
+	for (int32 LedgeIndex = 0; LedgeIndex < LedgeData.Num(); ++LedgeIndex)
+	{
+		const int32 First = LedgeData.GetFirstPoint(LedgeIndex);
+		for (int32 i = 1; i < LedgeData.GetNumPoints(LedgeIndex); ++i)
+		{
+			const int32 Point = First + i;
+			LedgeSegments.Add({
+				LedgeData.Points[Point - 1] + LedgeData.Ups[Point - 1] * LedgeUpOffset,
+				LedgeData.Points[Point] + LedgeData.Ups[Point] * LedgeUpOffset,
+				LedgeIndex,
+				Point - 1
+			});
+		}
+
+		const int32 OppositeLedge = LedgeData.OppositeLedges[LedgeIndex];
+		if (OppositeLedge != INDEX_NONE)
+		{
+			BakeLedgeCorrespondence(LedgeIndex, OppositeLedge, LedgeCorrespondences[LedgeIndex]);
+		}
+	}
+
+	if (!LedgeSegments.IsEmpty())
+	{
+		LedgeBVH.Reserve(2 * LedgeSegments.Num() / MaxSegmentsPerLeaf + 1);
+		BuildLedgeBVH(0, LedgeSegments.Num());
+	}
+
+	//The BVH sorted the segments, the lanes follow that order so a leaf is one contiguous run.
+	LedgeSegmentLanes.Reserve(LedgeSegments.Num());
+	for (const auto& Segment : LedgeSegments)
+	{
+		LedgeSegmentLanes.Add(Segment.Start, Segment.End);
+	}
+	LedgeSegmentLanes.Pad();
+
+	//The segments joining one ledge's last point to the next ledge's first are never inside a ledge's range.
+	LedgePointLanes.Reserve(LedgeData.Points.Num());
+	for (int32 Point = 0; Point + 1 < LedgeData.Points.Num(); ++Point)
+	{
+		LedgePointLanes.Add(LedgeData.Points[Point], LedgeData.Points[Point + 1]);
+	}
+	LedgePointLanes.Pad();
+
+	BakedLedgeVersion = LedgeVersion;
+}
+
+void ATraversableActor::BakeLedgeCorrespondence(const int32 FrontLedge, const int32 BackLedge,
+                                                FLedgeCorrespondence& OutCorrespondence) const
+{
+	const int32 NumFrontPoints = LedgeData.GetNumPoints(FrontLedge);
+	if (NumFrontPoints == 0 || LedgeData.GetNumPoints(BackLedge) == 0)
+	{
+		return;
+	}
+
+	//One sample per front point, the back ledge is found by walking its own points.
+	OutCorrespondence.SampleStep = LedgeData.GetStep(FrontLedge);
+	OutCorrespondence.Samples.SetNum(NumFrontPoints);
+	for (int32 i = 0; i < NumFrontPoints; ++i)
+	{
+		const FVector3f& FrontLocation = LedgeData.Points[LedgeData.GetFirstPoint(FrontLedge) + i];
+		const float BackDistance = LedgeData.FindDistanceClosestToLocation(BackLedge, FrontLocation);
+
+		auto& Sample = OutCorrespondence.Samples[i];
+		LedgeData.Evaluate(BackLedge, BackDistance, Sample.BackLocation, Sample.BackNormal);
+		Sample.Depth = (FrontLocation - Sample.BackLocation).Size2D();
+	}
+}
+
+float ATraversableActor::FindDistanceAlongLedgeLocked(const int32 Ledge, const FVector3f& Location) const
+{
+	const int32 First = LedgeData.GetFirstPoint(Ledge);
+	FLedgeSegmentHit Closest;
+	LedgePointLanes.FindClosest(First, LedgeData.GetNumPoints(Ledge) - 1, Location, Closest);
+	return Closest.IsValid() ? (Closest.Segment - First + Closest.Alpha) * LedgeData.GetStep(Ledge) : 0.0f;
+}
+
+int32 ATraversableActor::BuildLedgeBVH(const int32 Begin, const int32 End) const
+{
+	const int32 NodeIndex = LedgeBVH.AddDefaulted();
+	FBox3f Bounds{ForceInit};
+	for (int32 i = Begin; i < End; ++i)
+	{
+		Bounds += LedgeSegments[i].Start;
+		Bounds += LedgeSegments[i].End;
+	}
+	LedgeBVH[NodeIndex].Bounds = Bounds;
+
+	const int32 NumSegments = End - Begin;
+	if (NumSegments <= MaxSegmentsPerLeaf)
+	{
+		LedgeBVH[NodeIndex].FirstIndex = Begin;
+		LedgeBVH[NodeIndex].NumSegments = NumSegments;
+		return NodeIndex;
+	}
+
+	//Median split on the longest axis of the node.
+	const FVector3f Extent = Bounds.GetExtent();
+	const int32 Axis = Extent.X >= Extent.Y && Extent.X >= Extent.Z ? 0 : Extent.Y >= Extent.Z ? 1 : 2;
+	Algo::Sort(MakeArrayView(LedgeSegments.GetData() + Begin, NumSegments),
+	           [Axis](const FLedgeSegment& A, const FLedgeSegment& B)
+	           {
+		           return A.Start[Axis] + A.End[Axis] < B.Start[Axis] + B.End[Axis];
+	           });
+
+	const int32 Middle = Begin + NumSegments / 2;
+	BuildLedgeBVH(Begin, Middle);
+	const int32 RightChild = BuildLedgeBVH(Middle, End);
+	//Children may have grown the array, index again rather than holding on to a reference.
+	LedgeBVH[NodeIndex].FirstIndex = RightChild;
+	return NodeIndex;
+}
+
+int32 ATraversableActor::FindClosestLedgeIndexToLocation(const FVector& Location) const
+{
+	return FindClosestLedgeIndex(GetActorTransform(), Location);
+}
+
+int32 ATraversableActor::FindClosestLedgeIndex(const FTransform& LedgeToWorld, const FVector& Location) const
+{
+	BakeLedges();
+
+	FReadScopeLock ReadLock(LedgeIndexLock);
+	if (LedgeBVH.IsEmpty())
+	{
+		return INDEX_NONE;
+	}
+
+	const FVector3f LocalLocation{LedgeToWorld.InverseTransformPosition(Location)};
+	FLedgeSegmentHit Closest;
+	Closest.DistanceSquared = MaxLedgeDistanceSquared;
+
+	TArray<int32, TInlineAllocator<32>> Stack;
+	Stack.Add(0);
+	while (!Stack.IsEmpty())
+	{
+		const int32 NodeIndex = Stack.Pop(EAllowShrinking::No);
+		const FLedgeBVHNode& Node = LedgeBVH[NodeIndex];
+		if (Node.Bounds.ComputeSquaredDistanceToPoint(LocalLocation) >= Closest.DistanceSquared)
+		{
+			continue;
+		}
+
+		if (Node.IsLeaf())
+		{
+			LedgeSegmentLanes.FindClosest(Node.FirstIndex, Node.NumSegments, LocalLocation, Closest);
+			continue;
+		}
+
+		//Visit the nearer child first so the far one is more likely to be culled.
+		const int32 LeftChild = NodeIndex + 1;
+		const int32 RightChild = Node.FirstIndex;
+		const bool bLeftIsNearer = LedgeBVH[LeftChild].Bounds.ComputeSquaredDistanceToPoint(LocalLocation) <=
+			LedgeBVH[RightChild].Bounds.ComputeSquaredDistanceToPoint(LocalLocation);
+		Stack.Add(bLeftIsNearer ? RightChild : LeftChild);
+		Stack.Add(bLeftIsNearer ? LeftChild : RightChild);
+	}
+	return Closest.IsValid() ? LedgeSegments[Closest.Segment].LedgeIndex : INDEX_NONE;
+}
+
+void ATraversableActor::FindClosestLedges(const FTransform& LedgeToWorld, TConstArrayView<FVector> Locations,
+                                          TArrayView<FLedgeClosestPoint> OutClosest) const
+{
+	check(Locations.Num() == OutClosest.Num());
+	BakeLedges();
+
+	FReadScopeLock ReadLock(LedgeIndexLock);
+	for (int32 FirstQuery = 0; FirstQuery < Locations.Num(); FirstQuery += LedgeQueryPacketSize)
+	{
+		const int32 NumQueries = FMath::Min(LedgeQueryPacketSize, Locations.Num() - FirstQuery);
+		FVector3f LocalLocations[LedgeQueryPacketSize];
+		FLedgeSegmentHit Hits[LedgeQueryPacketSize];
+		for (int32 i = 0; i < NumQueries; ++i)
+		{
+			LocalLocations[i] = FVector3f{LedgeToWorld.InverseTransformPosition(Locations[FirstQuery + i])};
+			Hits[i].DistanceSquared = MaxLedgeDistanceSquared;
+		}
+		const TConstArrayView<FVector3f> PacketLocations{LocalLocations, NumQueries};
+
+		//The packet walks the tree together, a node is only skipped once it's too far for every query in it.
+		TArray<int32, TInlineAllocator<32>> Stack;
+		if (!LedgeBVH.IsEmpty())
+		{
+			Stack.Add(0);
+		}
+		while (!Stack.IsEmpty())
+		{
+			const int32 NodeIndex = Stack.Pop(EAllowShrinking::No);
+			const FLedgeBVHNode& Node = LedgeBVH[NodeIndex];
+			bool bAnyCloser = false;
+			for (int32 i = 0; i < NumQueries && !bAnyCloser; ++i)
+			{
+				bAnyCloser = Node.Bounds.ComputeSquaredDistanceToPoint(LocalLocations[i]) < Hits[i].DistanceSquared;
+			}
+			if (!bAnyCloser)
+			{
+				continue;
+			}
+
+			if (Node.IsLeaf())
+			{
+				LedgeSegmentLanes.FindClosestBatch(Node.FirstIndex, Node.NumSegments, PacketLocations,
+				                                   MakeArrayView(Hits, NumQueries));
+				continue;
+			}
+			Stack.Add(Node.FirstIndex);
+			Stack.Add(NodeIndex + 1);
+		}
+
+		for (int32 i = 0; i < NumQueries; ++i)
+		{
+			auto& Closest = OutClosest[FirstQuery + i];
+			Closest = FLedgeClosestPoint{};
+			if (!Hits[i].IsValid())
+			{
+				continue;
+			}
+
+			//The segment was raised off the ledge, the point and up vector come from the packed points it was made of.
+			const auto& Segment = LedgeSegments[Hits[i].Segment];
+			const float Alpha = Hits[i].Alpha;
+			const auto& Ups = LedgeData.Ups;
+			Closest.LedgeIndex = Segment.LedgeIndex;
+			Closest.Location = LedgeToWorld.TransformPosition(FVector{
+				FMath::Lerp(LedgeData.Points[Segment.Point], LedgeData.Points[Segment.Point + 1], Alpha)
+			});
+			Closest.Up = LedgeToWorld.TransformVectorNoScale(FVector{
+				FMath::Lerp(Ups[Segment.Point], Ups[Segment.Point + 1], Alpha).GetSafeNormal(
+					UE_SMALL_NUMBER, Ups[Segment.Point])
+			});
+			Closest.Distance = FMath::Sqrt(Hits[i].DistanceSquared);
+		}
+	}
+}
+
+int32 ATraversableActor::FindClosestLedgeIndexBySpline(const FVector& Location) const
 {
 	float CurrentDistance = 99999.f;
-	USplineComponent* ClosestSpline{nullptr};
+	int32 ClosestIndex{INDEX_NONE};
 
-	for (const auto SplineItem : LedgeSplines)
+	for (int32 i = 0; i < LedgeSplines.Num(); ++i)
 	{
+		const auto SplineItem = LedgeSplines[i];
 		FVector ClosestOnThisSpline = SplineItem->FindLocationClosestToWorldLocation(
 			Location, ESplineCoordinateSpace::World);
 		ClosestOnThisSpline += SplineItem->FindUpVectorClosestToWorldLocation(Location, ESplineCoordinateSpace::World) *
-			10.0f;
+			LedgeUpOffset;
 		const float DistToSpline = FVector::Distance(ClosestOnThisSpline, Location);
 		if (CurrentDistance > DistToSpline)
 		{
-			ClosestSpline = SplineItem;
+			ClosestIndex = i;
 			CurrentDistance = DistToSpline;
 		}
 	}
-	return ClosestSpline;
+	return ClosestIndex;
+}
+
+USplineComponent* ATraversableActor::FindClosestLedgeToLocation(const FVector& Location)
+{
+	const int32 ClosestIndex = FindClosestLedgeIndexToLocation(Location);
+	return LedgeSplines.IsValidIndex(ClosestIndex) ? LedgeSplines[ClosestIndex] : nullptr;
 }
 
 FTraversableCheckResult ATraversableActor::GetLedgeTransforms(const FVector HitLocation, const FVector ActorLocation)
 {
-	const USplineComponent* ClosestLedge = FindClosestLedgeToLocation(ActorLocation);
+	return GetLedgeTransformsInSpace(GetActorTransform(), HitLocation, ActorLocation);
+}
+
+FTraversableCheckResult ATraversableActor::GetLedgeTransformsForHit(const FHitResult& Hit,
+                                                                    const FVector& ActorLocation) const
+{
+	return GetLedgeTransformsInSpace(GetLedgeSpaceForHit(Hit), Hit.ImpactPoint, ActorLocation);
+}
+
+void ATraversableActor::GetLedgeInstances(TArray<FLedgeInstance>& OutInstances) const
+{
+	OutInstances.Reset();
+	OutInstances.Add({GetActorTransform(), INDEX_NONE});
+}
+
+FTraversableCheckResult ATraversableActor::GetLedgeTransformsInSpace(const FTransform& LedgeToWorld,
+                                                                     const FVector& HitLocation,
+                                                                     const FVector& ActorLocation) const
+{
+	return GetLedgeTransformsForLedge(LedgeToWorld, FindClosestLedgeIndex(LedgeToWorld, ActorLocation), HitLocation);
+}
+
+FTraversableCheckResult ATraversableActor::GetLedgeTransformsForLedge(const FTransform& LedgeToWorld,
+                                                                      const int32 ClosestIndex,
+                                                                      const FVector& HitLocation) const
+{
+	BakeLedges();
 	constexpr float MinLedgeWidth = 60.0f;
 	FTraversableCheckResult CheckResult{};
 
-	const auto SplineLength = ClosestLedge->GetSplineLength();
-	if (!ClosestLedge || SplineLength < MinLedgeWidth)
+	//Everything below reads the packed ledges and the tables baked from them, no spline component is touched.
+	FReadScopeLock ReadLock(LedgeIndexLock);
+	//The index may come from a search made before the ledges were last rebuilt.
+	if (!LedgeData.Lengths.IsValidIndex(ClosestIndex) || LedgeData.GetNumPoints(ClosestIndex) == 0)
 	{
 		return CheckResult;
 	}
 
-	const auto ClosestLocation = ClosestLedge->FindLocationClosestToWorldLocation(
-		HitLocation, ESplineCoordinateSpace::Local);
-	const auto DistanceAlongClosest = ClosestLedge->GetDistanceAlongSplineAtLocation(
-		ClosestLocation, ESplineCoordinateSpace::Local);
+	const auto LedgeLength = LedgeData.Lengths[ClosestIndex];
+	if (LedgeLength < MinLedgeWidth)
+	{
+		return CheckResult;
+	}
+
+	const auto DistanceAlongClosest = FindDistanceAlongLedgeLocked(
+		ClosestIndex, FVector3f{LedgeToWorld.InverseTransformPosition(HitLocation)});
 
 	const auto TransitivePoint = FMath::Clamp(DistanceAlongClosest, MinLedgeWidth / 2.0f,
-	                                          SplineLength - (MinLedgeWidth / 2.0f));
+	                                          LedgeLength - (MinLedgeWidth / 2.0f));
 
-	const auto FrontLedgeCheck = ClosestLedge->GetTransformAtDistanceAlongSpline(
-		TransitivePoint, ESplineCoordinateSpace::World);
+	FVector3f FrontLocation;
+	FVector3f FrontUp;
+	LedgeData.Evaluate(ClosestIndex, TransitivePoint, FrontLocation, FrontUp);
 
 	CheckResult.bHasFrontLedge = true;
-	CheckResult.FrontLedgeLocation = FrontLedgeCheck.GetLocation();
-	CheckResult.FrontLedgeNormal = FrontLedgeCheck.Rotator().Quaternion().GetUpVector();
+	CheckResult.FrontLedgeLocation = LedgeToWorld.TransformPosition(FVector{FrontLocation});
+	CheckResult.FrontLedgeNormal = LedgeToWorld.TransformVectorNoScale(FVector{FrontUp});
 
-	const auto OppositeLedge = OppositeLedges[ClosestLedge];
-	if (!OppositeLedge)
+	if (!LedgeCorrespondences.IsValidIndex(ClosestIndex) || !LedgeCorrespondences[ClosestIndex].HasOppositeLedge())
 	{
 		return CheckResult;
 	}
 
-	const auto BackLedgeCheck = OppositeLedge->FindTransformClosestToWorldLocation(
-		FrontLedgeCheck.GetLocation(), ESplineCoordinateSpace::World);
+	const auto BackLedge = LedgeCorrespondences[ClosestIndex].Evaluate(TransitivePoint);
 	CheckResult.bHasBackLedge = true;
-	CheckResult.BackLedgeLocation = BackLedgeCheck.GetLocation();
-	CheckResult.BackLedgeNormal = BackLedgeCheck.Rotator().Quaternion().GetUpVector();
+	CheckResult.BackLedgeLocation = LedgeToWorld.TransformPosition(FVector{BackLedge.BackLocation});
+	CheckResult.BackLedgeNormal = LedgeToWorld.TransformVectorNoScale(FVector{BackLedge.BackNormal});
+	CheckResult.ObstacleDepth = BackLedge.Depth;
 
 	return CheckResult;
 }
+
+#if !UE_BUILD_SHIPPING
+
+//Builds a throwaway traversable out of boxes, each box contributing its four top edges as ledges.
+static ATraversableActor* SpawnBenchmarkTraversable(UWorld* World, const int32 NumLedges,
+                                                    const FVector& Location = FVector::ZeroVector)
+{
+	FActorSpawnParameters SpawnParameters;
+	SpawnParameters.ObjectFlags = RF_Transient;
+	const auto Traversable = World->SpawnActor<ATraversableActor>(Location, FRotator::ZeroRotator, SpawnParameters);
+	if (!Traversable)
+	{
+		return nullptr;
+	}
+
+	const auto Root = NewObject<USceneComponent>(Traversable);
+	Root->SetRelativeLocation(Location);
+	Traversable->SetRootComponent(Root);
+	Root->RegisterComponent();
+
+	const FVector BoxExtent{100.0, 50.0, 100.0};
+	for (int32 i = 0; i < NumLedges; ++i)
+	{
+		const int32 Box = i / 4;
+		const FVector BoxCenter{Box % 8 * 300.0, Box / 8 * 300.0, BoxExtent.Z};
+		const FVector Corners[] = {
+			{-BoxExtent.X, -BoxExtent.Y, BoxExtent.Z}, {BoxExtent.X, -BoxExtent.Y, BoxExtent.Z},
+			{BoxExtent.X, BoxExtent.Y, BoxExtent.Z}, {-BoxExtent.X, BoxExtent.Y, BoxExtent.Z}
+		};
+
+		const auto Spline = NewObject<USplineComponent>(Traversable);
+		Spline->SetupAttachment(Root);
+		Spline->RegisterComponent();
+		Spline->SetSplinePoints(TArray<FVector>{BoxCenter + Corners[i % 4], BoxCenter + Corners[(i + 1) % 4]},
+		                        ESplineCoordinateSpace::Local);
+		Traversable->LedgeSplines.Add(Spline);
+	}
+	//Edges across from each other on a box are each other's opposite.
+	for (int32 i = 0; i < NumLedges; ++i)
+	{
+		if ((i ^ 2) < NumLedges)
+		{
+			Traversable->OppositeLedges.Add(Traversable->LedgeSplines[i], Traversable->LedgeSplines[i ^ 2]);
+		}
+	}
+	Traversable->MarkLedgesChanged();
+	return Traversable;
+}
+
+static FAutoConsoleCommandWithWorldAndArgs LedgeIndexBenchmarkCommand(
+	TEXT("Parkour.LedgeIndex.Benchmark"),
+	TEXT("Compares the baked ledge search, one query and batched, against evaluating every spline on traversables with 4, 32 and 256 ledges. Usage: Parkour.LedgeIndex.Benchmark [NumQueries]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		if (!World)
+		{
+			return;
+		}
+
+		const int32 NumQueries = Args.Num() > 0 ? FMath::Max(1, FCString::Atoi(*Args[0])) : 10000;
+		for (const int32 NumLedges : {4, 32, 256})
+		{
+			const auto Traversable = SpawnBenchmarkTraversable(World, NumLedges);
+			if (!Traversable)
+			{
+				continue;
+			}
+
+			const double BakeStart = FPlatformTime::Seconds();
+			Traversable->BakeLedges();
+			const double BakeMs = (FPlatformTime::Seconds() - BakeStart) * 1000.0;
+
+			FVector Origin;
+			FVector Extent;
+			Traversable->GetActorBounds(false, Origin, Extent, true);
+			Extent += FVector{200.0};
+
+			FRandomStream Random{NumLedges};
+			TArray<FVector> Locations;
+			Locations.Reserve(NumQueries);
+			for (int32 i = 0; i < NumQueries; ++i)
+			{
+				Locations.Add(Origin + Extent * FVector{Random.FRandRange(-1, 1), Random.FRandRange(-1, 1),
+				                                        Random.FRandRange(-1, 1)});
+			}
+
+			TArray<int32> SplineResults;
+			SplineResults.Reserve(NumQueries);
+			const double SplineStart = FPlatformTime::Seconds();
+			for (const auto& Location : Locations)
+			{
+				SplineResults.Add(Traversable->FindClosestLedgeIndexBySpline(Location));
+			}
+			const double SplineMs = (FPlatformTime::Seconds() - SplineStart) * 1000.0;
+
+			int32 NumMatching = 0;
+			const double BakedStart = FPlatformTime::Seconds();
+			for (int32 i = 0; i < NumQueries; ++i)
+			{
+				NumMatching += Traversable->FindClosestLedgeIndexToLocation(Locations[i]) == SplineResults[i];
+			}
+			const double BakedMs = (FPlatformTime::Seconds() - BakedStart) * 1000.0;
+
+			TArray<FLedgeClosestPoint> BatchResults;
+			BatchResults.SetNum(NumQueries);
+			const double BatchStart = FPlatformTime::Seconds();
+			Traversable->FindClosestLedges(Traversable->GetActorTransform(), Locations, BatchResults);
+			const double BatchMs = (FPlatformTime::Seconds() - BatchStart) * 1000.0;
+
+			int32 NumBatchMatching = 0;
+			for (int32 i = 0; i < NumQueries; ++i)
+			{
+				NumBatchMatching += BatchResults[i].LedgeIndex == SplineResults[i];
+			}
+
+			UE_LOG(LogTemp, Log,
+			       TEXT("Ledge index: %d ledges, %d segments, bake %.3f ms. Splines %.1f ns/query, baked %.1f ns/query (%.1f%% agree), batched %.1f ns/query (%.1f%% agree)"),
+			       NumLedges, Traversable->GetNumLedgeSegments(), BakeMs, SplineMs * 1e6 / NumQueries,
+			       BakedMs * 1e6 / NumQueries, 100.0 * NumMatching / NumQueries, BatchMs * 1e6 / NumQueries,
+			       100.0 * NumBatchMatching / NumQueries);
+
+			Traversable->Destroy();
+		}
+	}));
+
+static FAutoConsoleCommandWithWorldAndArgs LedgeDataMemoryReportCommand(
+	TEXT("Parkour.LedgeData.MemoryReport"),
+	TEXT("Compares the memory of ledge splines against the packed ledges of every traversable, optionally after generating more. Usage: Parkour.LedgeData.MemoryReport [NumGenerated]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		if (!World)
+		{
+			return;
+		}
+
+		//A generated level of fences, walls and boxes, four ledges each and laid out on a grid.
+		const int32 NumGenerated = Args.Num() > 0 ? FMath::Max(0, FCString::Atoi(*Args[0])) : 0;
+		const int32 GridSide = FMath::CeilToInt32(FMath::Sqrt(static_cast<float>(NumGenerated)));
+		TArray<ATraversableActor*> Generated;
+		for (int32 i = 0; i < NumGenerated; ++i)
+		{
+			Generated.Add(SpawnBenchmarkTraversable(World, 4, FVector{i % GridSide * 500.0, i / GridSide * 500.0, 0.0}));
+		}
+
+		int32 NumTraversables = 0;
+		int32 NumLedges = 0;
+		SIZE_T SplineBytes = 0;
+		SIZE_T PackedBytes = 0;
+		SIZE_T BakedBytes = 0;
+		for (TActorIterator<ATraversableActor> It{World}; It; ++It)
+		{
+			const auto Traversable = *It;
+			Traversable->BakeLedges();
+			++NumTraversables;
+			NumLedges += Traversable->GetLedgeData().Num();
+			SplineBytes += Traversable->GetLedgeSplineAllocatedSize();
+			PackedBytes += sizeof(FCompactLedgeData) + Traversable->GetLedgeData().GetAllocatedSize();
+			BakedBytes += Traversable->GetBakedLedgeAllocatedSize();
+		}
+
+		UE_LOG(LogTemp, Log,
+		       TEXT("Ledge memory: %d traversables, %d ledges. Splines %.1f KiB, packed %.1f KiB, baked at runtime %.1f KiB"),
+		       NumTraversables, NumLedges, SplineBytes / 1024.0, PackedBytes / 1024.0, BakedBytes / 1024.0);
+
+		for (const auto Traversable : Generated)
+		{
+			if (Traversable)
+			{
+				Traversable->Destroy();
+			}
+		}
+	}));
+
+#endif
@@ -0,0 +1,454 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Traversables/TraversableLedgeSubsystem.h"
+
+#include "Components/PrimitiveComponent.h"
+#include "Components/SplineComponent.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/PlatformTime.h"
+#include "Math/RandomStream.h"
+#include "Traversables/TraversableActor.h"
+
+static TAutoConsoleVariable<float> CVarLedgeIndexCellSize(
+	TEXT("Parkour.LedgeIndex.CellSize"),
+	200.0f,
+	TEXT("Size in cm of the cells of the world ledge grid, read when the world starts."));
+
+FLedgeSegmentGrid::FLedgeSegmentGrid(const float InCellSize) : CellSize{FMath::Max(InCellSize, 1.0f)}
+{
+}
+
+FIntVector FLedgeSegmentGrid::ToCell(const FVector& Location) const
+{
+	return FIntVector{
+		FMath::FloorToInt32(Location.X / CellSize),
+		FMath::FloorToInt32(Location.Y / CellSize),
+		FMath::FloorToInt32(Location.Z / CellSize)
+	};
+}
+
+void FLedgeSegmentGrid::GetCellRange(const FWorldLedgeSegment& Segment, FIntVector& OutMin, FIntVector& OutMax) const
+{
+	OutMin = ToCell(Segment.Start.ComponentMin(Segment.End));
+	OutMax = ToCell(Segment.Start.ComponentMax(Segment.End));
+}
+
+int32 FLedgeSegmentGrid::Add(const FWorldLedgeSegment& Segment)
+{
+	const int32 SegmentId = Segments.Add(Segment);
+
+	FIntVector Min;
+	FIntVector Max;
+	GetCellRange(Segment, Min, Max);
+	for (int32 Z = Min.Z; Z <= Max.Z; ++Z)
+	{
+		for (int32 Y = Min.Y; Y <= Max.Y; ++Y)
+		{
+			for (int32 X = Min.X; X <= Max.X; ++X)
+			{
+				Cells.FindOrAdd(FIntVector{X, Y, Z}).Add(SegmentId);
+			}
+		}
+	}
+	return SegmentId;
+}
+
+void FLedgeSegmentGrid::Remove(const int32 SegmentId)
+{
+	if (!Segments.IsValidIndex(SegmentId))
+	{
+		return;
+	}
+
+	FIntVector Min;
+	FIntVector Max;
+	GetCellRange(Segments[SegmentId], Min, Max);
+	for (int32 Z = Min.Z; Z <= Max.Z; ++Z)
+	{
+		for (int32 Y = Min.Y; Y <= Max.Y; ++Y)
+		{
+			for (int32 X = Min.X; X <= Max.X; ++X)
+			{
+				const FIntVector Cell{X, Y, Z};
+				if (const auto CellSegments = Cells.Find(Cell))
+				{
+					CellSegments->RemoveSingleSwap(SegmentId, EAllowShrinking::No);
+					if (CellSegments->IsEmpty())
+					{
+						Cells.Remove(Cell);
+					}
+				}
+			}
+		}
+	}
+	Segments.RemoveAt(SegmentId);
+}
+
+void FLedgeSegmentGrid::Reset()
+{
+	Segments.Reset();
+	Cells.Reset();
+}
+
+bool FLedgeSegmentGrid::ClipSegment(const FLedgeQuery& Query, const FWorldLedgeSegment& Segment,
+                                    FLedgeQueryResult& OutResult)
+{
+	//Work in the query's frame, where the volume is an axis aligned box and the segment is a line a + d * t.
+	const FVector Forward = Query.Direction.GetSafeNormal2D();
+	const FVector Right{-Forward.Y, Forward.X, 0.0};
+	const FVector Start = Segment.Start - Query.Origin;
+	const FVector Delta = Segment.End - Segment.Start;
+
+	const double Starts[] = {Start | Forward, Start | Right, Start.Z};
+	const double Deltas[] = {Delta | Forward, Delta | Right, Delta.Z};
+	const double Mins[] = {0.0, -Query.HalfWidth, Query.MinHeight};
+	const double Maxs[] = {Query.Length, Query.HalfWidth, Query.MaxHeight};
+
+	double TMin = 0.0;
+	double TMax = 1.0;
+	for (int32 Axis = 0; Axis < 3; ++Axis)
+	{
+		if (FMath::Abs(Deltas[Axis]) < UE_DOUBLE_SMALL_NUMBER)
+		{
+			if (Starts[Axis] < Mins[Axis] || Starts[Axis] > Maxs[Axis])
+			{
+				return false;
+			}
+			continue;
+		}
+
+		double T0 = (Mins[Axis] - Starts[Axis]) / Deltas[Axis];
+		double T1 = (Maxs[Axis] - Starts[Axis]) / Deltas[Axis];
+		if (T0 > T1)
+		{
+			Swap(T0, T1);
+		}
+		TMin = FMath::Max(TMin, T0);
+		TMax = FMath::Min(TMax, T1);
+		if (TMin > TMax)
+		{
+			return false;
+		}
+	}
+
+	//Distance along the query is linear in t, so the nearest part of the clipped segment is one of its ends.
+	const double T = Deltas[0] >= 0.0 ? TMin : TMax;
+	OutResult.Traversable = Segment.Traversable;
+	OutResult.LedgeIndex = Segment.LedgeIndex;
+	OutResult.Item = Segment.Item;
+	OutResult.Location = Segment.Start + Delta * T;
+	OutResult.Distance = Starts[0] + Deltas[0] * T;
+	return true;
+}
+
+bool FLedgeSegmentGrid::FindBest(const FLedgeQuery& Query, FLedgeQueryResult& OutResult) const
+{
+	const FVector Forward = Query.Direction.GetSafeNormal2D();
+	const FVector Right{-Forward.Y, Forward.X, 0.0};
+
+	FBox Bounds{ForceInit};
+	for (const double Along : {0.0, static_cast<double>(Query.Length)})
+	{
+		for (const double Across : {-Query.HalfWidth, Query.HalfWidth})
+		{
+			const FVector Corner = Query.Origin + Forward * Along + Right * Across;
+			Bounds += Corner + FVector{0.0, 0.0, Query.MinHeight};
+			Bounds += Corner + FVector{0.0, 0.0, Query.MaxHeight};
+		}
+	}
+	const FIntVector QueryMin = ToCell(Bounds.Min);
+	const FIntVector QueryMax = ToCell(Bounds.Max);
+
+	bool bFound = false;
+	FLedgeQueryResult Candidate;
+	for (int32 Z = QueryMin.Z; Z <= QueryMax.Z; ++Z)
+	{
+		for (int32 Y = QueryMin.Y; Y <= QueryMax.Y; ++Y)
+		{
+			for (int32 X = QueryMin.X; X <= QueryMax.X; ++X)
+			{
+				const FIntVector Cell{X, Y, Z};
+				const auto CellSegments = Cells.Find(Cell);
+				if (!CellSegments)
+				{
+					continue;
+				}
+
+				for (const int32 SegmentId : *CellSegments)
+				{
+					const auto& Segment = Segments[SegmentId];
+
+					//A segment spanning several cells is only tested in the first one both ranges share.
+					FIntVector SegmentMin;
+					FIntVector SegmentMax;
+					GetCellRange(Segment, SegmentMin, SegmentMax);
+					const FIntVector FirstShared{
+						FMath::Max(SegmentMin.X, QueryMin.X),
+						FMath::Max(SegmentMin.Y, QueryMin.Y),
+						FMath::Max(SegmentMin.Z, QueryMin.Z)
+					};
+					if (FirstShared != Cell)
+					{
+						continue;
+					}
+
+					if (ClipSegment(Query, Segment, Candidate) && (!bFound || Candidate.Distance < OutResult.Distance))
+					{
+						OutResult = Candidate;
+						bFound = true;
+					}
+				}
+			}
+		}
+	}
+	return bFound;
+}
+
+bool FLedgeSegmentGrid::FindBestBruteForce(const FLedgeQuery& Query, FLedgeQueryResult& OutResult) const
+{
+	bool bFound = false;
+	FLedgeQueryResult Candidate;
+	for (const auto& Segment : Segments)
+	{
+		if (ClipSegment(Query, Segment, Candidate) && (!bFound || Candidate.Distance < OutResult.Distance))
+		{
+			OutResult = Candidate;
+			bFound = true;
+		}
+	}
+	return bFound;
+}
+
+void UTraversableLedgeSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+	Grid = FLedgeSegmentGrid{CVarLedgeIndexCellSize.GetValueOnGameThread()};
+}
+
+void UTraversableLedgeSubsystem::Deinitialize()
+{
+	for (auto& [Key, Registered] : Traversables)
+	{
+		if (const auto Root = Registered.Root.Get())
+		{
+			Root->TransformUpdated.Remove(Registered.TransformUpdatedHandle);
+		}
+	}
+	Traversables.Reset();
+
+	FWriteScopeLock WriteLock(GridLock);
+	Grid.Reset();
+	Super::Deinitialize();
+}
+
+void UTraversableLedgeSubsystem::RegisterTraversable(ATraversableActor* Traversable)
+{
+	check(Traversable);
+	if (Traversables.Contains(Traversable))
+	{
+		UpdateTraversable(Traversable);
+		return;
+	}
+
+	auto& Registered = Traversables.Add(Traversable);
+
+	//Spline components are primitives too, the one a sweep hits is whatever actually blocks.
+	Traversable->ForEachComponent<UPrimitiveComponent>(false, [&Registered](UPrimitiveComponent* Component)
+	{
+		if (!Registered.CollisionComponent.IsValid() && !Component->IsA<USplineComponent>() &&
+			Component->IsQueryCollisionEnabled())
+		{
+			Registered.CollisionComponent = Component;
+		}
+	});
+
+	if (const auto Root = Traversable->GetRootComponent())
+	{
+		Registered.Root = Root;
+		Registered.TransformUpdatedHandle = Root->TransformUpdated.AddUObject(
+			this, &UTraversableLedgeSubsystem::OnTraversableMoved);
+	}
+
+	AddSegments(Traversable, Registered.SegmentIds);
+}
+
+void UTraversableLedgeSubsystem::UnregisterTraversable(ATraversableActor* Traversable)
+{
+	FRegisteredTraversable Registered;
+	if (!Traversables.RemoveAndCopyValue(Traversable, Registered))
+	{
+		return;
+	}
+
+	if (const auto Root = Registered.Root.Get())
+	{
+		Root->TransformUpdated.Remove(Registered.TransformUpdatedHandle);
+	}
+	RemoveSegments(Registered.SegmentIds);
+}
+
+void UTraversableLedgeSubsystem::UpdateTraversable(ATraversableActor* Traversable)
+{
+	const auto Registered = Traversables.Find(Traversable);
+	if (!Registered)
+	{
+		return;
+	}
+
+	RemoveSegments(Registered->SegmentIds);
+	AddSegments(Traversable, Registered->SegmentIds);
+}
+
+void UTraversableLedgeSubsystem::AddSegments(ATraversableActor* Traversable, TArray<int32>& OutSegmentIds)
+{
+	TArray<FLedgeSegment> LocalSegments;
+	Traversable->GetLedgeSegments(LocalSegments);
+	TArray<FLedgeInstance> Instances;
+	Traversable->GetLedgeInstances(Instances);
+
+	FWriteScopeLock WriteLock(GridLock);
+	OutSegmentIds.Reset(LocalSegments.Num() * Instances.Num());
+	for (const auto& Instance : Instances)
+	{
+		for (const auto& LocalSegment : LocalSegments)
+		{
+			FWorldLedgeSegment Segment;
+			Segment.Start = Instance.LedgeToWorld.TransformPosition(FVector{LocalSegment.Start});
+			Segment.End = Instance.LedgeToWorld.TransformPosition(FVector{LocalSegment.End});
+			Segment.Traversable = Traversable;
+			Segment.LedgeIndex = LocalSegment.LedgeIndex;
+			Segment.Item = Instance.Item;
+			OutSegmentIds.Add(Grid.Add(Segment));
+		}
+	}
+}
+
+void UTraversableLedgeSubsystem::RemoveSegments(TArray<int32>& SegmentIds)
+{
+	FWriteScopeLock WriteLock(GridLock);
+	for (const int32 SegmentId : SegmentIds)
+	{
+		Grid.Remove(SegmentId);
+	}
+	SegmentIds.Reset();
+}
+
+void UTraversableLedgeSubsystem::OnTraversableMoved(USceneComponent* UpdatedComponent,
+                                                    EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport)
+{
+	if (const auto Traversable = Cast<ATraversableActor>(UpdatedComponent->GetOwner()))
+	{
+		UpdateTraversable(Traversable);
+	}
+}
+
+bool UTraversableLedgeSubsystem::FindBestLedge(const FLedgeQuery& Query, FLedgeQueryResult& OutResult) const
+{
+	FReadScopeLock ReadLock(GridLock);
+	return Grid.FindBest(Query, OutResult);
+}
+
+UPrimitiveComponent* UTraversableLedgeSubsystem::GetCollisionComponent(const ATraversableActor* Traversable) const
+{
+	const auto Registered = Traversables.Find(Traversable);
+	return Registered ? Registered->CollisionComponent.Get() : nullptr;
+}
+
+bool UTraversableLedgeSubsystem::DoesSupportWorldType(const EWorldType::Type WorldType) const
+{
+	return WorldType == EWorldType::Game || WorldType == EWorldType::PIE;
+}
+
+#if !UE_BUILD_SHIPPING
+
+//Scatters ledges at a constant density, so a bigger index means a bigger world rather than a more crowded one.
+static FAutoConsoleCommand LedgeGridBenchmarkCommand(
+	TEXT("Parkour.LedgeIndex.GridBenchmark"),
+	TEXT("Measures the world ledge grid against a linear scan with 1k, 10k and 100k segments. Usage: Parkour.LedgeIndex.GridBenchmark [NumQueries]"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		constexpr int32 SegmentsPerLedge = 8;
+		constexpr double SegmentLength = 25.0;
+		constexpr double AreaPerLedge = 400.0 * 400.0;
+
+		const int32 NumQueries = Args.Num() > 0 ? FMath::Max(1, FCString::Atoi(*Args[0])) : 10000;
+		for (const int32 NumSegments : {1000, 10000, 100000})
+		{
+			FRandomStream Random{NumSegments};
+			const int32 NumLedges = NumSegments / SegmentsPerLedge;
+			const double HalfSide = FMath::Sqrt(NumLedges * AreaPerLedge) / 2.0;
+
+			TArray<FWorldLedgeSegment> Segments;
+			Segments.Reserve(NumSegments);
+			for (int32 Ledge = 0; Ledge < NumLedges; ++Ledge)
+			{
+				FVector Location{
+					Random.FRandRange(-HalfSide, HalfSide), Random.FRandRange(-HalfSide, HalfSide),
+					Random.FRandRange(50.0, 250.0)
+				};
+				const FVector Step = FRotator{0.0, Random.FRandRange(0.0, 360.0), 0.0}.Vector() * SegmentLength;
+				for (int32 i = 0; i < SegmentsPerLedge; ++i)
+				{
+					FWorldLedgeSegment Segment;
+					Segment.Start = Location;
+					Segment.End = Location + Step;
+					Segment.LedgeIndex = Ledge;
+					Segments.Add(Segment);
+					Location += Step;
+				}
+			}
+
+			FLedgeSegmentGrid Grid{CVarLedgeIndexCellSize.GetValueOnGameThread()};
+			const double BuildStart = FPlatformTime::Seconds();
+			for (const auto& Segment : Segments)
+			{
+				Grid.Add(Segment);
+			}
+			const double BuildMs = (FPlatformTime::Seconds() - BuildStart) * 1000.0;
+
+			TArray<FLedgeQuery> Queries;
+			Queries.Reserve(NumQueries);
+			for (int32 i = 0; i < NumQueries; ++i)
+			{
+				FLedgeQuery Query;
+				Query.Origin = FVector{Random.FRandRange(-HalfSide, HalfSide), Random.FRandRange(-HalfSide, HalfSide), 90.0};
+				Query.Direction = FRotator{0.0, Random.FRandRange(0.0, 360.0), 0.0}.Vector();
+				Query.Length = 200.0f;
+				Query.HalfWidth = 40.0f;
+				Query.MinHeight = -90.0f;
+				Query.MaxHeight = 300.0f;
+				Queries.Add(Query);
+			}
+
+			TArray<FLedgeQueryResult> GridResults;
+			GridResults.SetNum(NumQueries);
+			int32 NumFound = 0;
+			const double GridStart = FPlatformTime::Seconds();
+			for (int32 i = 0; i < NumQueries; ++i)
+			{
+				NumFound += Grid.FindBest(Queries[i], GridResults[i]);
+			}
+			const double GridMs = (FPlatformTime::Seconds() - GridStart) * 1000.0;
+
+			//The scan is linear in the number of segments, fewer queries keep the 100k run short.
+			const int32 NumScanQueries = FMath::Clamp(NumQueries * 1000 / NumSegments, 1, NumQueries);
+			int32 NumMatching = 0;
+			const double ScanStart = FPlatformTime::Seconds();
+			for (int32 i = 0; i < NumScanQueries; ++i)
+			{
+				FLedgeQueryResult ScanResult;
+				const bool bFound = Grid.FindBestBruteForce(Queries[i], ScanResult);
+				NumMatching += bFound == (GridResults[i].LedgeIndex != INDEX_NONE) &&
+					(!bFound || FMath::IsNearlyEqual(ScanResult.Distance, GridResults[i].Distance));
+			}
+			const double ScanMs = (FPlatformTime::Seconds() - ScanStart) * 1000.0;
+
+			UE_LOG(LogTemp, Log,
+			       TEXT("Ledge grid: %d segments in %d cells, build %.3f ms. Grid %.1f ns/query (%d of %d found), scan %.1f ns/query, %d of %d agree"),
+			       Grid.GetNumSegments(), Grid.GetNumCells(), BuildMs, GridMs * 1e6 / NumQueries, NumFound, NumQueries,
+			       ScanMs * 1e6 / NumScanQueries, NumMatching, NumScanQueries);
+		}
+	}));
+
+#endif
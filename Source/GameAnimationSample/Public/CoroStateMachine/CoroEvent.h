@@ -0,0 +1,33 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+struct CoroStateMachine;
+
+struct CoroEventWaiter
+{
+	CoroStateMachine* Machine{nullptr};
+	CoroEventWaiter* Next{nullptr};
+	CoroEventWaiter* Prev{nullptr};
+
+	bool IsWaiting() const { return Prev != nullptr; }
+	void Cancel();
+};
+
+//A signal that any number of state machines can sleep on, waiters are intrusive so waiting never allocates.
+class CoroEvent
+{
+public:
+	CoroEvent();
+	~CoroEvent();
+	CoroEvent(const CoroEvent&) = delete;
+	CoroEvent& operator=(const CoroEvent&) = delete;
+
+	//Wakes every machine currently waiting on this event.
+	void Signal();
+	void AddWaiter(CoroEventWaiter& Waiter);
+	bool HasWaiters() const { return Head.Next != &Head; }
+
+private:
+	CoroEventWaiter Head;
+};
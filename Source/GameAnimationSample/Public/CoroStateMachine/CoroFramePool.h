@@ -0,0 +1,37 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include <cstddef>
+
+struct CoroFramePoolStats
+{
+	static constexpr size_t NumSizeClasses = 16;
+
+	uint64 Allocations{0};
+	//Served from a free list or a chunk already owned, without touching the global allocator.
+	uint64 PoolHits{0};
+	//The misses, together with OversizedAllocations.
+	uint64 ChunkAllocations{0};
+	uint64 OversizedAllocations{0};
+	uint64 LargestFrame{0};
+	uint64 SizeClassAllocations[NumSizeClasses]{};
+
+	double GetHitRate() const { return Allocations ? static_cast<double>(PoolHits) / Allocations : 0.0; }
+};
+
+//Size classed allocator for coroutine frames.
+//Frames are carved out of large chunks and recycled through per thread free lists, once every size class a state machine
+//uses has been warmed up, changing state never touches the global allocator again. Chunks live for the whole process.
+struct CoroFramePool
+{
+	static constexpr size_t SizeClassGranularity = 64;
+	static constexpr size_t NumSizeClasses = CoroFramePoolStats::NumSizeClasses;
+	static constexpr size_t MaxPooledFrameSize = SizeClassGranularity * NumSizeClasses;
+	static constexpr size_t ChunkSize = 64 * 1024;
+
+	static void* Allocate(size_t Size);
+	static void Free(void* Frame, size_t Size) noexcept;
+
+	static CoroFramePoolStats GetStats();
+	static void ResetStats();
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <concepts>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+inline constexpr size_t CoroInlineFunctionCapacity = 64;
+
+template <typename Signature, size_t Capacity = CoroInlineFunctionCapacity>
+class CoroInlineFunction;
+
+//A std::function replacement that never allocates, the callable is always stored inline.
+//Callables that don't fit are a compile error rather than a silent heap fallback.
+template <typename ReturnType, typename... ArgTypes, size_t Capacity>
+class CoroInlineFunction<ReturnType(ArgTypes...), Capacity>
+{
+public:
+	CoroInlineFunction() = default;
+
+	CoroInlineFunction(std::nullptr_t)
+	{
+	}
+
+	template <typename FuncType>
+		requires (!std::same_as<std::decay_t<FuncType>, CoroInlineFunction> &&
+			std::invocable<std::decay_t<FuncType>&, ArgTypes...>)
+	CoroInlineFunction(FuncType&& Func)
+	{
+		Emplace(std::forward<FuncType>(Func));
+	}
+
+	CoroInlineFunction(const CoroInlineFunction& Other)
+	{
+		CopyFrom(Other);
+	}
+
+	CoroInlineFunction(CoroInlineFunction&& Other) noexcept
+	{
+		MoveFrom(Other);
+	}
+
+	~CoroInlineFunction()
+	{
+		Reset();
+	}
+
+	CoroInlineFunction& operator=(const CoroInlineFunction& Other)
+	{
+		if (this != &Other)
+		{
+			Reset();
+			CopyFrom(Other);
+		}
+		return *this;
+	}
+
+	CoroInlineFunction& operator=(CoroInlineFunction&& Other) noexcept
+	{
+		if (this != &Other)
+		{
+			Reset();
+			MoveFrom(Other);
+		}
+		return *this;
+	}
+
+	CoroInlineFunction& operator=(std::nullptr_t)
+	{
+		Reset();
+		return *this;
+	}
+
+	template <typename FuncType>
+		requires (!std::same_as<std::decay_t<FuncType>, CoroInlineFunction> &&
+			std::invocable<std::decay_t<FuncType>&, ArgTypes...>)
+	CoroInlineFunction& operator=(FuncType&& Func)
+	{
+		Reset();
+		Emplace(std::forward<FuncType>(Func));
+		return *this;
+	}
+
+	explicit operator bool() const { return Ops != nullptr; }
+
+	ReturnType operator()(ArgTypes... Args) const
+	{
+		return Ops->Invoke(Storage, std::forward<ArgTypes>(Args)...);
+	}
+
+	void Reset()
+	{
+		if (Ops)
+		{
+			Ops->Destroy(Storage);
+			Ops = nullptr;
+		}
+	}
+
+private:
+	struct OpsTable
+	{
+		ReturnType (*Invoke)(void*, ArgTypes&&...);
+		void (*Copy)(void*, const void*);
+		void (*Move)(void*, void*);
+		void (*Destroy)(void*);
+	};
+
+	template <typename FuncType>
+	static constexpr OpsTable OpsFor{
+		[](void* Func, ArgTypes&&... Args) -> ReturnType
+		{
+			return (*static_cast<FuncType*>(Func))(std::forward<ArgTypes>(Args)...);
+		},
+		[](void* Dest, const void* Src) { new(Dest) FuncType(*static_cast<const FuncType*>(Src)); },
+		[](void* Dest, void* Src) { new(Dest) FuncType(std::move(*static_cast<FuncType*>(Src))); },
+		[](void* Func) { static_cast<FuncType*>(Func)->~FuncType(); }
+	};
+
+	template <typename FuncType>
+	void Emplace(FuncType&& Func)
+	{
+		using StoredType = std::decay_t<FuncType>;
+		static_assert(sizeof(StoredType) <= Capacity, "Callable is too large for CoroInlineFunction storage.");
+		static_assert(alignof(StoredType) <= alignof(std::max_align_t), "Callable is over aligned.");
+		static_assert(std::is_copy_constructible_v<StoredType>, "CoroInlineFunction requires copyable callables.");
+
+		new(Storage) StoredType(std::forward<FuncType>(Func));
+		Ops = &OpsFor<StoredType>;
+	}
+
+	void CopyFrom(const CoroInlineFunction& Other)
+	{
+		if (Other.Ops)
+		{
+			Other.Ops->Copy(Storage, Other.Storage);
+			Ops = Other.Ops;
+		}
+	}
+
+	void MoveFrom(CoroInlineFunction& Other)
+	{
+		if (Other.Ops)
+		{
+			Other.Ops->Move(Storage, Other.Storage);
+			Ops = Other.Ops;
+			Other.Reset();
+		}
+	}
+
+	alignas(std::max_align_t) mutable unsigned char Storage[Capacity];
+	const OpsTable* Ops{nullptr};
+};
@@ -2,6 +2,8 @@
 #include <coroutine>
 #include <utility>
 
+#include "CoroFramePool.h"
+
 struct CoroState;
 
 struct CoroState
@@ -11,6 +13,9 @@ struct CoroState
 
 	struct promise_type
 	{
+		static void* operator new(const size_t Size) { return CoroFramePool::Allocate(Size); }
+		static void operator delete(void* Frame, const size_t Size) noexcept { CoroFramePool::Free(Frame, Size); }
+
 		void unhandled_exception() noexcept
 		{
 		}
@@ -5,82 +5,274 @@
 #include "CoreMinimal.h"
 #include <concepts>
 #include <coroutine>
-#include <stack>
-#include <deque>
-#include <vector>
 
+#include "CoroEvent.h"
+#include "CoroInlineFunction.h"
 #include "CoroState.h"
 #include "CoroTask.h"
+#include "CoroTimerWheel.h"
 
 struct CoroState;
-struct CoroTask;
 
 struct CoroStateMachine;
+template <typename T>
 struct TaskAwaiter;
+struct WaitAwaiter;
+template <typename... ArgTypes>
+struct DelegateAwaiter;
 
 using namespace std;
 
+using CoroTransitionFunc = CoroInlineFunction<bool()>;
+using CoroStateFunc = CoroInlineFunction<CoroState()>;
+using CoroActionFunc = CoroInlineFunction<void()>;
+
+enum class ECoroTransitionEvaluation : uint8
+{
+	//One transition is evaluated per Run, the ring is walked over successive ticks.
+	RoundRobin,
+	//Every transition is evaluated each Run in descending priority, watched transitions only when their inputs are dirty.
+	Priority
+};
+
+enum class ECoroWaitKind : uint8
+{
+	None,
+	Seconds,
+	Frames,
+	Event
+};
+
 struct TransitionBundle
 {
-	std::function<bool()> TransFunc;
-	std::function<CoroState()> StateFunc;
+	CoroTransitionFunc TransFunc;
+	CoroStateFunc StateFunc;
+	int32 Priority{0};
+	//Input bits this transition depends on, zero means it's evaluated every Run.
+	uint32 WatchMask{0};
 };
 
 struct CoroStateMachine
 {
+	template <typename T>
 	friend struct TaskAwaiter;
+	friend struct WaitAwaiter;
+	template <typename... ArgTypes>
+	friend struct DelegateAwaiter;
+
+	static constexpr int32 MaxTransitions = 16;
+	static constexpr int32 MaxStatelessTasks = 8;
 
 	CoroStateMachine()
 	{
 	};
 
+	CoroStateMachine(const CoroStateMachine&) = delete;
+	CoroStateMachine& operator=(const CoroStateMachine&) = delete;
+
 	void Destroy();
 
 	void ChangeToState(const CoroState& NewState);
 	void Reset();
 	bool Run();
 
-	TaskAwaiter WaitForTask(CoroTask&& TaskToAwait);
+	//The awaited task starts right away and resumes its caller as soon as it finishes, all within the same Run.
+	template <typename T>
+	TaskAwaiter<T> WaitForTask(CoroTask<T>&& TaskToAwait);
+
+	//Suspend the running coroutine without being resumed every tick until the wait is over.
+	WaitAwaiter WaitSeconds(float Seconds);
+	WaitAwaiter WaitFrames(uint32 Frames);
+	WaitAwaiter WaitUntilSignaled(CoroEvent& Event);
+	//The delegate must outlive the wait.
+	template <typename... ArgTypes>
+	DelegateAwaiter<ArgTypes...> WaitForDelegate(TMulticastDelegate<void(ArgTypes...)>& Delegate);
+
+	CoroStateMachine& AddStatelessTask(CoroActionFunc Task);
+	CoroStateMachine& AddTransition(CoroTransitionFunc TransitionFunc, CoroStateFunc StateConstructor,
+	                                int32 Priority = 0, uint32 WatchMask = 0);
+	CoroStateMachine& ContinueWith(CoroStateFunc StateConstructor);
+	CoroStateMachine& OnExit(CoroActionFunc Finalizer);
+
+	void SetTransitionEvaluation(const ECoroTransitionEvaluation Mode) { TransitionEvaluation = Mode; }
+	ECoroTransitionEvaluation GetTransitionEvaluation() const { return TransitionEvaluation; }
+
+	//Flags watched inputs as changed so the transitions watching them are evaluated on the next Run.
+	void MarkDirty(const uint32 InputMask) { DirtyInputs |= InputMask; }
+
+	void SetSleepHost(CoroSleepHost* InSleepHost);
+	CoroSleepHost* GetSleepHost() const { return SleepHost; }
+
+	bool IsWaiting() const { return WaitKind != ECoroWaitKind::None; }
+	//A waiting machine with nothing to evaluate per tick can be dropped from the tick loop until it wakes.
+	bool CanPark() const { return IsWaiting() && NumTransitions == 0 && NumStatelessTasks == 0; }
+	void Wake();
 
-	CoroStateMachine& AddStatelessTask(const std::function<void()>& Task);
-	CoroStateMachine& AddTransition(const std::function<bool()>& TransitionFunc,
-	                                const std::function<CoroState()>& StateConstructor);
-	CoroStateMachine& ContinueWith(const std::function<CoroState()>& StateConstructor);
-	CoroStateMachine& OnExit(const std::function<void()>& Finalizer);
+	//Owned by the sleep host, where this machine lives in its records.
+	int32 HostSlot{INDEX_NONE};
 
 private:
 	void FreeEntireCoroutineStack();
-	void AwaitPush(const coroutine_handle<> NewHandle);
-	std::function<CoroState()> CheckNextTransition();
+	void AwaitPush(CoroTaskPromiseBase& Promise);
+	const TransitionBundle* CheckNextTransition();
+	const TransitionBundle* CheckTransitionsByPriority();
+
+	void SuspendForSeconds(float Seconds);
+	void SuspendForFrames(uint32 Frames);
+	void SuspendForEvent(CoroEvent& Event);
+	void CancelWait();
+	bool PollWait();
+	static void OnWakeTimer(CoroTimerNode& Node);
 
 	CoroState CurrentState{nullptr};
-	std::function<CoroState()> NextState{nullptr};
-	std::function<void()> OnExitFunc{nullptr};
-	coroutine_handle<> CurrentTask{nullptr};
-	stack<coroutine_handle<>> CoroutineStack;
-	std::deque<TransitionBundle> CurrentStateTransitions{};
-	std::vector<std::function<void()>> CurrentStatelessTasks{};
+	CoroStateFunc NextState{nullptr};
+	CoroActionFunc OnExitFunc{nullptr};
+
+	//Innermost awaited task, each task links to its parent through its promise so awaiting never allocates.
+	CoroTaskPromiseBase* TaskTop{nullptr};
+
+	//Fixed capacity ring, round robin evaluation just advances the cursor instead of rotating the bundles.
+	TransitionBundle Transitions[MaxTransitions]{};
+	int32 NumTransitions{0};
+	int32 NextTransition{0};
+	int32 NumUnwatchedTransitions{0};
+	uint32 DirtyInputs{~0u};
+	ECoroTransitionEvaluation TransitionEvaluation{ECoroTransitionEvaluation::RoundRobin};
+
+	CoroActionFunc StatelessTasks[MaxStatelessTasks]{};
+	int32 NumStatelessTasks{0};
+
+	ECoroWaitKind WaitKind{ECoroWaitKind::None};
+	CoroSleepHost* SleepHost{nullptr};
+	CoroTimerNode WakeTimer{&CoroStateMachine::OnWakeTimer, this};
+	CoroEventWaiter EventWaiter{this};
+	//Deadlines used when there's no sleep host to wake us.
+	double FallbackWakeTime{0.0};
+	uint64 FallbackWakeFrame{0};
+
 	bool Sleeping{false};
 };
 
+template <typename T>
 struct TaskAwaiter
 {
 	CoroStateMachine& SM;
-	CoroTask Task;
+	CoroTask<T> Task;
 
-	explicit TaskAwaiter(CoroStateMachine& InSM, CoroTask&& TaskToAwait) : SM{InSM}, Task{std::move(TaskToAwait)}
+	explicit TaskAwaiter(CoroStateMachine& InSM, CoroTask<T>&& TaskToAwait) : SM{InSM}, Task{std::move(TaskToAwait)}
 	{
 	}
 
 	bool await_ready() const noexcept { return false; }
 
-	bool await_suspend(const std::coroutine_handle<> Handle) noexcept
+	//Symmetric transfer, the child runs now instead of on the next Run.
+	std::coroutine_handle<> await_suspend(const std::coroutine_handle<> Handle) noexcept
 	{
-		SM.AwaitPush(Task.Handle);
-		return true;
+		auto& Promise = Task.Handle.promise();
+		Promise.Continuation = Handle;
+		SM.AwaitPush(Promise);
+		return Task.Handle;
+	}
+
+	//The finished child is freed here, if the machine resets first it frees the child itself.
+	T await_resume()
+	{
+		const auto Handle = Task.Handle;
+		Task.Handle = nullptr;
+		if constexpr (std::is_void_v<T>)
+		{
+			Handle.destroy();
+		}
+		else
+		{
+			T Result = std::move(*Handle.promise().Result);
+			Handle.destroy();
+			return Result;
+		}
+	}
+};
+
+template <typename T>
+TaskAwaiter<T> CoroStateMachine::WaitForTask(CoroTask<T>&& TaskToAwait)
+{
+	return TaskAwaiter<T>{*this, std::move(TaskToAwait)};
+}
+
+struct WaitAwaiter
+{
+	CoroStateMachine& SM;
+	ECoroWaitKind Kind;
+	float Seconds{0.0f};
+	uint32 Frames{0};
+	CoroEvent* Event{nullptr};
+
+	bool await_ready() const noexcept
+	{
+		return (Kind == ECoroWaitKind::Seconds && Seconds <= 0.0f) || (Kind == ECoroWaitKind::Frames && Frames == 0);
+	}
+
+	void await_suspend(const std::coroutine_handle<> Handle) noexcept
+	{
+		switch (Kind)
+		{
+		case ECoroWaitKind::Seconds: SM.SuspendForSeconds(Seconds);
+			break;
+		case ECoroWaitKind::Frames: SM.SuspendForFrames(Frames);
+			break;
+		case ECoroWaitKind::Event: SM.SuspendForEvent(*Event);
+			break;
+		default: break;
+		}
 	}
 
 	void await_resume() const noexcept
 	{
 	}
 };
+
+template <typename... ArgTypes>
+struct DelegateAwaiter
+{
+	CoroStateMachine& SM;
+	TMulticastDelegate<void(ArgTypes...)>& Delegate;
+	CoroEvent Event;
+	FDelegateHandle Binding;
+
+	DelegateAwaiter(CoroStateMachine& InSM, TMulticastDelegate<void(ArgTypes...)>& InDelegate)
+		: SM{InSM}, Delegate{InDelegate}
+	{
+	}
+
+	~DelegateAwaiter()
+	{
+		Unbind();
+	}
+
+	bool await_ready() const noexcept { return false; }
+
+	void await_suspend(const std::coroutine_handle<> Handle) noexcept
+	{
+		Binding = Delegate.AddLambda([this](ArgTypes...) { Event.Signal(); });
+		SM.SuspendForEvent(Event);
+	}
+
+	void await_resume() noexcept
+	{
+		Unbind();
+	}
+
+	void Unbind()
+	{
+		if (Binding.IsValid())
+		{
+			Delegate.Remove(Binding);
+			Binding.Reset();
+		}
+	}
+};
+
+template <typename... ArgTypes>
+DelegateAwaiter<ArgTypes...> CoroStateMachine::WaitForDelegate(TMulticastDelegate<void(ArgTypes...)>& Delegate)
+{
+	return DelegateAwaiter<ArgTypes...>{*this, Delegate};
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <type_traits>
+
+#include "CoroStateMachine.h"
+
+//A state graph declared entirely in types.
+//States bind an id to a member coroutine of the context, transitions bind two ids to a member predicate.
+//Every predicate and constructor is a compile time constant, so dispatch folds down to a switch over the current id
+//with the predicates inlined, and the graph can be checked for unknown or unreachable states at compile time.
+//
+//	using FLocomotionGraph = CoroStaticStateGraph<
+//		UMyComponent, EMyState::Idle,
+//		CoroTypeList<CoroStaticState<EMyState::Idle, &UMyComponent::IdleState>, ...>,
+//		CoroTypeList<CoroStaticTransition<EMyState::Idle, &UMyComponent::WantsToMove, EMyState::Moving>, ...>>;
+
+template <typename... Types>
+struct CoroTypeList
+{
+};
+
+template <auto InId, auto InConstructor>
+struct CoroStaticState
+{
+	static constexpr auto Id = InId;
+	static constexpr auto Constructor = InConstructor;
+};
+
+//Transitions leaving the same state are evaluated in declaration order, the first one that passes wins.
+template <auto InFrom, auto InPredicate, auto InTo>
+struct CoroStaticTransition
+{
+	static constexpr auto From = InFrom;
+	static constexpr auto Predicate = InPredicate;
+	static constexpr auto To = InTo;
+};
+
+template <typename ContextType, auto InitialState, typename StateList, typename TransitionList>
+class CoroStaticStateGraph;
+
+template <typename ContextType, auto InitialState, typename... States, typename... Transitions>
+class CoroStaticStateGraph<ContextType, InitialState, CoroTypeList<States...>, CoroTypeList<Transitions...>>
+{
+public:
+	using StateIdType = decltype(InitialState);
+
+	static constexpr size_t NumStates = sizeof...(States);
+	static constexpr size_t NumTransitions = sizeof...(Transitions);
+
+	static_assert(NumStates > 0, "A static state graph needs at least one state.");
+	static_assert((std::is_same_v<std::remove_const_t<decltype(States::Id)>, StateIdType> && ...),
+	              "Every state id must have the same type as the initial state.");
+
+	explicit CoroStaticStateGraph(ContextType& InContext) : Context{InContext}
+	{
+	}
+
+	void Start()
+	{
+		ChangeTo<InitialState>();
+	}
+
+	//Evaluates the static transitions leaving the current state, then steps the underlying machine.
+	bool Run()
+	{
+		EvaluateTransitions();
+		return Machine.Run();
+	}
+
+	StateIdType GetCurrentState() const { return CurrentState; }
+
+	//Tasks, awaiters and dynamic transitions all still go through the underlying machine.
+	CoroStateMachine& GetMachine() { return Machine; }
+
+	void Destroy() { Machine.Destroy(); }
+
+	static constexpr size_t IndexOf(const StateIdType Id)
+	{
+		constexpr std::array<StateIdType, NumStates> Ids{States::Id...};
+		for (size_t i = 0; i < NumStates; ++i)
+		{
+			if (Ids[i] == Id)
+			{
+				return i;
+			}
+		}
+		return NumStates;
+	}
+
+	static constexpr bool IsReachable(const StateIdType Id)
+	{
+		constexpr std::array<size_t, NumTransitions + 1> Froms{IndexOf(Transitions::From)..., 0};
+		constexpr std::array<size_t, NumTransitions + 1> Tos{IndexOf(Transitions::To)..., 0};
+
+		std::array<bool, NumStates> Reached{};
+		Reached[IndexOf(InitialState)] = true;
+
+		//Relax until nothing changes, graphs are small enough that this is cheap even at compile time.
+		bool bChanged = true;
+		while (bChanged)
+		{
+			bChanged = false;
+			for (size_t i = 0; i < NumTransitions; ++i)
+			{
+				if (Reached[Froms[i]] && !Reached[Tos[i]])
+				{
+					Reached[Tos[i]] = true;
+					bChanged = true;
+				}
+			}
+		}
+		return Reached[IndexOf(Id)];
+	}
+
+	static constexpr bool AllStatesReachable()
+	{
+		return (IsReachable(States::Id) && ...);
+	}
+
+	static_assert(IndexOf(InitialState) < NumStates, "The initial state isn't declared in the graph.");
+	static_assert(((IndexOf(Transitions::From) < NumStates) && ...), "A transition leaves an undeclared state.");
+	static_assert(((IndexOf(Transitions::To) < NumStates) && ...), "A transition targets an undeclared state.");
+
+private:
+	template <StateIdType Id>
+	void ChangeTo()
+	{
+		//Resolved at compile time, exactly one state matches.
+		((States::Id == Id ? (Machine.ChangeToState((Context.*States::Constructor)()), true) : false) || ...);
+		CurrentState = Id;
+	}
+
+	template <typename Transition, StateIdType From>
+	bool TryTransition()
+	{
+		if constexpr (Transition::From == From)
+		{
+			if ((Context.*Transition::Predicate)())
+			{
+				ChangeTo<Transition::To>();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	template <StateIdType From>
+	bool EvaluateFrom()
+	{
+		return (TryTransition<Transitions, From>() || ...);
+	}
+
+	void EvaluateTransitions()
+	{
+		//Every arm is a constant comparison, the optimizer turns this into a switch on CurrentState.
+		((CurrentState == States::Id ? EvaluateFrom<States::Id>() : false) || ...);
+	}
+
+	ContextType& Context;
+	CoroStateMachine Machine;
+	StateIdType CurrentState{InitialState};
+};
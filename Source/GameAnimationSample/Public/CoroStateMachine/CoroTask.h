@@ -1,29 +1,86 @@
 #pragma once
 #include <coroutine>
+#include <optional>
 #include <utility>
 
+#include "CoroFramePool.h"
+
+template <typename T = void>
 struct CoroTask;
 
-struct CoroTask
+struct CoroTaskPromiseBase
 {
-	struct promise_type;
-	using TaskHandle = std::coroutine_handle<promise_type>;
+	static void* operator new(const size_t Size) { return CoroFramePool::Allocate(Size); }
+	static void operator delete(void* Frame, const size_t Size) noexcept { CoroFramePool::Free(Frame, Size); }
 
-	struct promise_type
+	struct FinalAwaiter
 	{
-		void unhandled_exception() noexcept
+		bool await_ready() const noexcept { return false; }
+
+		//Pops this task off the machine's await stack and resumes whoever awaited it in the same tick.
+		template <typename PromiseType>
+		std::coroutine_handle<> await_suspend(const std::coroutine_handle<PromiseType> Handle) noexcept
 		{
+			CoroTaskPromiseBase& Promise = Handle.promise();
+			if (Promise.StackTop)
+			{
+				*Promise.StackTop = Promise.ParentTask;
+			}
+			return Promise.Continuation ? Promise.Continuation : std::noop_coroutine();
 		}
 
-		CoroTask get_return_object() { return TaskHandle::from_promise(*this); }
-		std::suspend_always initial_suspend() noexcept { return {}; }
-		std::suspend_always final_suspend() noexcept { return {}; }
-
-		void return_void() const noexcept
+		void await_resume() const noexcept
 		{
 		}
 	};
 
+	void unhandled_exception() noexcept
+	{
+	}
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	FinalAwaiter final_suspend() noexcept { return {}; }
+
+	//This frame type erased, so the machine can free a stack of tasks with different result types.
+	std::coroutine_handle<> Self{nullptr};
+	//The coroutine that awaited this task, resumed by symmetric transfer once we finish.
+	std::coroutine_handle<> Continuation{nullptr};
+	//Intrusive await stack, the task that was running when this one was awaited.
+	CoroTaskPromiseBase* ParentTask{nullptr};
+	//The owning machine's stack top, so finishing never needs to know about the machine itself.
+	CoroTaskPromiseBase** StackTop{nullptr};
+};
+
+template <typename T>
+struct CoroTaskPromise : CoroTaskPromiseBase
+{
+	CoroTask<T> get_return_object();
+
+	template <typename ValueType>
+	void return_value(ValueType&& Value)
+	{
+		Result.emplace(std::forward<ValueType>(Value));
+	}
+
+	std::optional<T> Result;
+};
+
+template <>
+struct CoroTaskPromise<void> : CoroTaskPromiseBase
+{
+	CoroTask<void> get_return_object();
+
+	void return_void() const noexcept
+	{
+	}
+};
+
+template <typename T>
+struct CoroTask
+{
+	using promise_type = CoroTaskPromise<T>;
+	using TaskHandle = std::coroutine_handle<promise_type>;
+
 	TaskHandle Handle;
 
 	CoroTask(const TaskHandle H) : Handle{H}
@@ -36,3 +93,18 @@ struct CoroTask
 	explicit operator TaskHandle() const { return Handle; }
 	explicit operator bool() const { return Handle && !Handle.done(); }
 };
+
+template <typename T>
+CoroTask<T> CoroTaskPromise<T>::get_return_object()
+{
+	const auto Handle = CoroTask<T>::TaskHandle::from_promise(*this);
+	Self = Handle;
+	return Handle;
+}
+
+inline CoroTask<void> CoroTaskPromise<void>::get_return_object()
+{
+	const auto Handle = CoroTask<void>::TaskHandle::from_promise(*this);
+	Self = Handle;
+	return Handle;
+}
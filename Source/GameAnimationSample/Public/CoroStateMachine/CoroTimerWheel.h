@@ -0,0 +1,89 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+
+struct CoroStateMachine;
+class CoroTimerWheel;
+
+//Intrusive timer entry, owners embed it so scheduling never allocates.
+struct CoroTimerNode
+{
+	using CallbackType = void(*)(CoroTimerNode&);
+
+	CallbackType Callback{nullptr};
+	void* Owner{nullptr};
+	uint64 Deadline{0};
+	CoroTimerNode* Next{nullptr};
+	CoroTimerNode* Prev{nullptr};
+	//The wheel the node is scheduled on, only that wheel may unlink it.
+	CoroTimerWheel* Wheel{nullptr};
+
+	bool IsScheduled() const { return Prev != nullptr; }
+};
+
+//Hierarchical timer wheel, 4 levels of 64 slots.
+//Scheduling and cancelling are O(1), advancing only touches the slots that come due plus an occasional cascade.
+class CoroTimerWheel
+{
+public:
+	static constexpr int32 SlotBits = 6;
+	static constexpr int32 NumSlots = 1 << SlotBits;
+	static constexpr int32 NumLevels = 4;
+	static constexpr uint64 SlotMask = NumSlots - 1;
+	static constexpr uint64 MaxDelay = (1ull << (SlotBits * NumLevels)) - 1;
+
+	CoroTimerWheel();
+	CoroTimerWheel(const CoroTimerWheel&) = delete;
+	CoroTimerWheel& operator=(const CoroTimerWheel&) = delete;
+
+	//Fires the node's callback once DelayTicks have been advanced, a delay of zero fires on the next tick.
+	void Schedule(CoroTimerNode& Node, uint64 DelayTicks);
+	//Does nothing unless the node is scheduled on this wheel.
+	void Cancel(CoroTimerNode& Node);
+	void Advance(uint64 Ticks);
+
+	uint64 GetNow() const { return Now; }
+	int32 Num() const { return NumScheduled; }
+
+private:
+	void Insert(CoroTimerNode& Node);
+	void Cascade(int32 Level, uint64 Slot);
+	static void Unlink(CoroTimerNode& Node);
+	static void Link(CoroTimerNode& Sentinel, CoroTimerNode& Node);
+
+	CoroTimerNode Slots[NumLevels][NumSlots];
+	uint64 Now{0};
+	int32 NumScheduled{0};
+};
+
+//Wakes suspended machines on time, the scheduler owns one and advances it once per frame.
+//Machines without a host fall back to checking their own deadline every Run.
+struct CoroSleepHost
+{
+	static constexpr double TicksPerSecond = 1000.0;
+
+	virtual ~CoroSleepHost() = default;
+
+	void Advance(double DeltaSeconds);
+
+	//Machines may suspend from worker threads when they're run in parallel, so wheel access is locked.
+	void ScheduleSeconds(CoroTimerNode& Node, double Seconds);
+	void ScheduleFrames(CoroTimerNode& Node, uint32 Frames);
+	void CancelTimer(CoroTimerNode& Node);
+
+	virtual void OnMachineSuspended(CoroStateMachine& Machine)
+	{
+	}
+
+	virtual void OnMachineWoken(CoroStateMachine& Machine)
+	{
+	}
+
+	CoroTimerWheel SecondsWheel;
+	CoroTimerWheel FramesWheel;
+
+private:
+	FCriticalSection TimerLock;
+	double PendingTicks{0.0};
+};
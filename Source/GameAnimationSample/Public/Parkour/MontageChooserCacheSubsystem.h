@@ -0,0 +1,102 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Parkour/ParkourComponent.h"
+#include "Parkour/TraversalWarpTable.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "MontageChooserCacheSubsystem.generated.h"
+
+class UChooserTable;
+
+//Chooser params rounded to buckets, every traversal landing in the same buckets of the same chooser shares candidates.
+struct FMontageChooserCacheKey
+{
+	TObjectKey<UChooserTable> Chooser;
+	EMovementGait Gait{EMovementGait::Walk};
+	EParkourActionType ParkourAction{EParkourActionType::NoValidAction};
+	int32 HeightBucket{0};
+	int32 DepthBucket{0};
+	int32 SpeedBucket{0};
+
+	bool operator==(const FMontageChooserCacheKey& Other) const
+	{
+		return Chooser == Other.Chooser && Gait == Other.Gait && ParkourAction == Other.ParkourAction &&
+			HeightBucket == Other.HeightBucket && DepthBucket == Other.DepthBucket && SpeedBucket == Other.SpeedBucket;
+	}
+
+	friend uint32 GetTypeHash(const FMontageChooserCacheKey& Key)
+	{
+		return HashCombine(HashCombine(GetTypeHash(Key.Chooser), GetTypeHash(static_cast<uint8>(Key.Gait) << 8 |
+			                               static_cast<uint8>(Key.ParkourAction))),
+		                   HashCombine(HashCombine(GetTypeHash(Key.HeightBucket), GetTypeHash(Key.DepthBucket)),
+		                               GetTypeHash(Key.SpeedBucket)));
+	}
+};
+
+struct FMontageChooserCacheStats
+{
+	uint64 Hits{0};
+	uint64 Misses{0};
+	uint64 Selections{0};
+	double SelectionMs{0.0};
+
+	double GetHitRate() const
+	{
+		const uint64 Lookups = Hits + Misses;
+		return Lookups ? static_cast<double>(Hits) / Lookups : 0.0;
+	}
+
+	double GetAverageSelectionMs() const { return Selections ? SelectionMs / Selections : 0.0; }
+};
+
+//Remembers which montages a traversal chooser returned for each bucket of chooser params, so selecting a traversal
+//montage only runs the pose search over the cached candidates. Entries live until the chooser asset is edited.
+UCLASS()
+class GAMEANIMATIONSAMPLE_API UMontageChooserCacheSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+
+	//The chooser's candidates for these params. A miss runs the chooser on the caller's params, exactly what the
+	//uncached path returns, and later params in the same buckets reuse that. Game thread only.
+	void GetCandidates(const UChooserTable* Chooser, const FMovementChooserParams& Params,
+	                   TArray<UObject*>& OutCandidates);
+
+	//Every candidate the chooser returns for Params, uncached.
+	static void EvaluateChooser(const UChooserTable* Chooser, const FMovementChooserParams& Params,
+	                            TArray<UObject*>& OutCandidates);
+
+	//Adds a finished montage selection, chooser and pose search together, to the timing counters.
+	void RecordSelection(double Milliseconds);
+
+	//Warp windows and curve distances of a traversal montage. Parkour components bake their chooser's montages at begin
+	//play and anything else is baked when its bucket is first evaluated, so by the time one is picked this is a lookup.
+	const FTraversalWarpMetadata& FindOrBakeWarpMetadata(const UAnimMontage* Montage);
+
+	FMontageChooserCacheStats GetStats() const;
+	void ResetCache();
+
+	int32 GetNumEntries() const { return Cache.Num(); }
+	int32 GetNumWarpEntries() const { return WarpTable.Num(); }
+
+protected:
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+
+	static FMontageChooserCacheKey MakeKey(const UChooserTable* Chooser, const FMovementChooserParams& Params);
+
+#if WITH_EDITOR
+	void OnObjectPropertyChanged(UObject* Object, FPropertyChangedEvent& PropertyChangedEvent);
+	FDelegateHandle ObjectPropertyChangedHandle;
+#endif
+
+	//Weak, the chooser owns its results and a reloaded chooser may drop them.
+	TMap<FMontageChooserCacheKey, TArray<TWeakObjectPtr<UObject>>> Cache;
+	//Outlives chooser flushes, a montage's warp notifies don't depend on which chooser returned it.
+	FTraversalWarpTable WarpTable;
+	FMontageChooserCacheStats Stats;
+};
@@ -7,11 +7,20 @@
 #include "MotionWarpingComponent.h"
 #include "Components/ActorComponent.h"
 #include "CoroStateMachine/CoroStateMachine.h"
+#include "Engine/EngineBaseTypes.h"
+#include "Engine/TimerHandle.h"
+#include "Tasks/Task.h"
 #include "Traversables/TraversableActor.h"
 #include "ParkourComponent.generated.h"
 
 class UChooserTable;
 class UInputAction;
+class UParkourComponent;
+class UPoseSearchDatabase;
+struct FStreamableHandle;
+struct FTraversalQueryRequest;
+
+DECLARE_STATS_GROUP(TEXT("Parkour"), STATGROUP_Parkour, STATCAT_Advanced);
 
 UENUM(BlueprintType)
 enum class EMovementGait : uint8
@@ -46,10 +55,96 @@ struct FMovementChooserParams
 	float Speed{0.0};
 };
 
+//What the pose search picked to play for a traversal.
+struct FParkourMontageSelection
+{
+	UAnimMontage* Anim{nullptr};
+	float Time{0.0f};
+	float PlayRate{1.0f};
+};
+
+//World mutations recorded by the state machine, applied on the game thread so the read only part can run anywhere.
+struct FParkourCommandBuffer
+{
+	TOptional<float> MaxWalkSpeed;
+	TOptional<bool> UpdateRotation;
+	bool bJump{false};
+	bool bStartTraversal{false};
+	//Launches the pose search for TraversalCheck and ParkourAction on a worker.
+	bool bStartMontageSearch{false};
+	FTraversableCheckResult TraversalCheck;
+	EParkourActionType ParkourAction{EParkourActionType::NoValidAction};
+	//Picked ahead of time, unset means the traversal selects its montage when it starts.
+	TOptional<FParkourMontageSelection> MontageSelection;
+
+	void Reset() { *this = FParkourCommandBuffer{}; }
+};
+
+//Rolling guess at what a jump would do right now, refreshed in the background so a jump press can use it immediately.
+struct FParkourTraversalPrediction
+{
+	//Unset when the last refresh found nothing to traverse.
+	TOptional<FTraversableCheckResult> TraversalCheck;
+	FVector SampleLocation{FVector::ZeroVector};
+	FRotator SampleRotation{FRotator::ZeroRotator};
+	double SampleTime{0.0};
+	TWeakObjectPtr<UPrimitiveComponent> Traversable;
+	FTransform TraversableTransform;
+	bool bValid{false};
+};
+
+//Runs after the state machine and before the character's mesh ticks, so the animation update waits for a montage
+//search still reading the pose history.
+USTRUCT()
+struct FParkourMontageSearchFence : public FTickFunction
+{
+	GENERATED_BODY()
+
+	UParkourComponent* Component{nullptr};
+
+	virtual void ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread,
+	                         const FGraphEventRef& MyCompletionGraphEvent) override;
+	virtual FString DiagnosticMessage() override;
+};
+
+template <>
+struct TStructOpsTypeTraits<FParkourMontageSearchFence> : public TStructOpsTypeTraitsBase2<FParkourMontageSearchFence>
+{
+	enum
+	{
+		WithCopy = false
+	};
+};
+
+//Runs after the character's mesh ticks and launches the montage search the state machine asked for, so the search
+//has until the next animation update to itself instead of holding up this one.
+USTRUCT()
+struct FParkourMontageSearchLaunch : public FTickFunction
+{
+	GENERATED_BODY()
+
+	UParkourComponent* Component{nullptr};
+
+	virtual void ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread,
+	                         const FGraphEventRef& MyCompletionGraphEvent) override;
+	virtual FString DiagnosticMessage() override;
+};
+
+template <>
+struct TStructOpsTypeTraits<FParkourMontageSearchLaunch> : public TStructOpsTypeTraitsBase2<FParkourMontageSearchLaunch>
+{
+	enum
+	{
+		WithCopy = false
+	};
+};
+
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FSetInteractionTransformDelegate, FTransform, NewTransform);
 
 DECLARE_DYNAMIC_MULTICAST_DELEGATE_OneParam(FTraverseLookup, FMovementChooserParams, ChooserParams);
 
+DECLARE_DYNAMIC_MULTICAST_DELEGATE(FTraversalWarmUpFinished);
+
 class UCharacterMovementComponent;
 
 UCLASS(ClassGroup=(Custom), meta=(BlueprintSpawnableComponent))
@@ -66,6 +161,7 @@ public:
 	UFUNCTION(BlueprintCallable)
 	float CalculateMaxSpeed() const;
 	CoroState ParkourStateMachine();
+	bool CanParkStateMachine() const;
 	void Move(const FInputActionValue& InputActionValue);
 	void Look(const FInputActionValue& InputActionValue);
 	void LookGamepad(const FInputActionValue& InputActionValue);
@@ -74,14 +170,47 @@ public:
 	float GetForwardTraversalTraceDistance(const FVector& CurrentVelocity, const FRotator& CurrentRotation) const;
 	bool SelectParkourMontage(EParkourActionType ActionType, const FTraversableCheckResult& TraversalCheck,
 	                          UAnimMontage*& OutAnim, float& OutTime, float& OutPlayRate) const;
+	void GatherMontageCandidates(EParkourActionType ActionType, const FTraversableCheckResult& TraversalCheck,
+	                             TArray<UObject*>& OutCandidates) const;
+	//The pose search over the chooser's candidates. Safe on a worker as long as the anim instance isn't updating.
+	static bool SearchMontageCandidates(UAnimInstance* AnimInstance, TArray<UObject*> Candidates,
+	                                    FParkourMontageSelection& OutSelection);
+	//Game thread only, the search itself runs on a worker.
+	void StartMontageSearch(const FTraversableCheckResult& TraversalCheck, EParkourActionType ActionType);
+	//Resolves to the search result, or the fallback montage once the deadline passes.
+	CoroTask<TOptional<FParkourMontageSelection>> MontageSelectionTask(EParkourActionType ActionType);
+	//Launches the search ApplyCommands queued, if any.
+	void LaunchPendingMontageSearch();
+	//Waits for a search still running, one that finishes past its deadline is dropped for the fallback.
+	void WaitForMontageSearch();
+	//Every montage, pose search database and nested chooser the chooser references, hard or soft, found through the
+	//asset registry.
+	static void GatherTraversalAssets(const UChooserTable* Chooser, TArray<FSoftObjectPath>& OutAssets);
+	void StartTraversalWarmUp();
+	//Warp metadata for the loaded montages among TraversalWarmUpAssets.
+	void BakeTraversalWarpMetadata();
+	void OnTraversalAssetsLoaded();
+	void PollPoseSearchIndexBuilds();
+	void FinishTraversalWarmUp();
 	void UpdateMotionWarping(const UAnimMontage* Anim, const FTraversableCheckResult& TraversalCheck,
 	                         const EParkourActionType ActionType) const;
 	static bool DetermineParkourAction(const FTraversableCheckResult& TraversalCheck,
 	                                   const bool bDebugEnabled,
 	                                   EParkourActionType& OutParkourActionType);
+	FTraversalQueryRequest MakeTraversalQueryRequest(float CapsuleRadius, float CapsuleHalfHeight) const;
 	bool PerformTraversalCheck(FTraversableCheckResult& OutTraversalCheck, float CapsuleRadius, float CapsuleHalfHeight,
 	                           bool bDebugEnabled) const;
+	CoroTask<TOptional<FTraversableCheckResult>> TraversalCheckTask() const;
+	CoroTask<TOptional<FTraversableCheckResult>> AsyncTraversalCheckTask();
+	void RefreshTraversalPrediction();
+	bool IsTraversalPredictionUsable() const;
+	uint32 GetSpeculativeHits() const { return SpeculativeHits; }
+	uint32 GetSpeculativeMisses() const { return SpeculativeMisses; }
+	bool FindTraversalAction(FTraversableCheckResult& OutTraversalCheck, EParkourActionType& OutParkourAction) const;
+	bool StartTraversalAction(const FTraversableCheckResult& TraversalCheck, EParkourActionType ActionType,
+	                          const FParkourMontageSelection* MontageSelection = nullptr);
 	bool TryTraversalAction(FTraversableCheckResult& OutTraversalData, EParkourActionType& OutParkourAction);
+	void ApplyCommands();
 
 	UFUNCTION()
 	void OnAnimInstanceMontageEndOrAbort(UAnimMontage* Montage, bool bInterrupted);
@@ -99,12 +228,55 @@ public:
 	UPROPERTY(BlueprintAssignable, Category = "Interaction")
 	FTraverseLookup OnTryTraverse;
 
+	//Broadcast once every asset the traversal chooser can return is loaded and warmed up.
+	UPROPERTY(BlueprintAssignable, Category = "Animation")
+	FTraversalWarmUpFinished OnTraversalWarmUpFinished;
+
+	UFUNCTION(BlueprintCallable, Category = "Animation")
+	bool IsTraversalWarmUpFinished() const { return bTraversalWarmUpFinished; }
+
 protected:
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 	virtual void BeginDestroy() override;
 
 	//Not a uproperty.
 	CoroStateMachine StateMachine;
+	//Signaled by every input the state machine reacts to, an idle machine sleeps on it instead of polling.
+	CoroEvent ParkourInputEvent;
+
+	FParkourCommandBuffer Commands;
+
+	//Run the state machine from the world's batched scheduler, turn off if this component needs its own tick group.
+	UPROPERTY(EditAnywhere, Category="Parkour")
+	bool bUseBatchedScheduler{true};
+
+	//Let the batched scheduler run this state machine on a worker, its world mutations are applied afterwards.
+	UPROPERTY(EditAnywhere, Category="Parkour", meta=(EditCondition="bUseBatchedScheduler"))
+	bool bRunStateMachineInParallel{false};
+
+	//Issue the traversal sweeps through the async scene query API instead of blocking the game thread on them.
+	//The check resolves a frame or two after the jump is pressed.
+	UPROPERTY(EditAnywhere, Category="Parkour")
+	bool bUseAsyncTraversalCheck{false};
+
+	//Keep a traversal check for whatever is in front of the character ready, so a jump press can act on it the same frame.
+	UPROPERTY(EditAnywhere, Category="Parkour|Speculative")
+	bool bUseSpeculativeTraversalCheck{false};
+
+	//Seconds between background traversal checks.
+	UPROPERTY(EditAnywhere, Category="Parkour|Speculative", meta=(EditCondition="bUseSpeculativeTraversalCheck", ClampMin=0.0))
+	float SpeculativeRefreshInterval{0.1f};
+
+	//Moving or turning further than this since the last check makes it unusable until the next refresh.
+	UPROPERTY(EditAnywhere, Category="Parkour|Speculative", meta=(EditCondition="bUseSpeculativeTraversalCheck", ClampMin=0.0))
+	float SpeculativeInvalidationDistance{50.0f};
+	UPROPERTY(EditAnywhere, Category="Parkour|Speculative", meta=(EditCondition="bUseSpeculativeTraversalCheck", ClampMin=0.0))
+	float SpeculativeInvalidationAngle{15.0f};
+
+	FParkourTraversalPrediction TraversalPrediction;
+	uint32 SpeculativeHits{0};
+	uint32 SpeculativeMisses{0};
 
 	UPROPERTY()
 	TObjectPtr<ACharacter> ControlledCharacter;
@@ -134,6 +306,53 @@ protected:
 	UPROPERTY(EditAnywhere, Category="Animation")
 	TObjectPtr<UChooserTable> TraversalAnimChooser;
 
+	//Pick the traversal montage on a worker while the state machine waits, instead of on the game thread when the
+	//traversal starts.
+	UPROPERTY(EditAnywhere, Category="Animation")
+	bool bUseAsyncMontageSelection{false};
+
+	//Seconds from launching the search after which its result is dropped and the fallback montage for the action plays.
+	UPROPERTY(EditAnywhere, Category="Animation", meta=(EditCondition="bUseAsyncMontageSelection", ClampMin=0.0))
+	float MontageSelectionDeadline{0.05f};
+
+	//Played from the start when the search misses its deadline, without one the traversal waits for the search.
+	UPROPERTY(EditAnywhere, Category="Animation", meta=(EditCondition="bUseAsyncMontageSelection"))
+	TMap<EParkourActionType, TObjectPtr<UAnimMontage>> FallbackTraversalMontages;
+
+	//Stream in everything the chooser can return at begin play, so the first traversal doesn't load it. Montages that
+	//are already loaded have their warp metadata baked at begin play either way.
+	UPROPERTY(EditAnywhere, Category="Animation|WarmUp")
+	bool bWarmUpTraversalAssets{true};
+
+	//Also build the search indices of the chooser's pose search databases. Only the editor builds them lazily, cooked
+	//databases already carry theirs.
+	UPROPERTY(EditAnywhere, Category="Animation|WarmUp", meta=(EditCondition="bWarmUpTraversalAssets"))
+	bool bPrebuildPoseSearchIndices{true};
+
+	//Keeps the warmed up assets loaded for as long as the component plays.
+	TSharedPtr<FStreamableHandle> TraversalWarmUpHandle;
+	TArray<FSoftObjectPath> TraversalWarmUpAssets;
+	UPROPERTY()
+	TArray<TObjectPtr<UPoseSearchDatabase>> PendingPoseSearchIndexBuilds;
+	FTimerHandle PoseSearchIndexBuildTimer;
+	double TraversalWarmUpStart{0.0};
+	bool bTraversalWarmUpFinished{false};
+
+	//From the jump press to the montage playing, for the first traversal of the session only.
+	double TraversalRequestTime{0.0};
+	bool bFirstTraversalMeasured{false};
+
+	UE::Tasks::TTask<TOptional<FParkourMontageSelection>> MontageSearch;
+	double MontageSearchStartTime{0.0};
+	//The fence had to wait on the search past its deadline.
+	bool bMontageSearchExpired{false};
+	//Queued by ApplyCommands, launched once the mesh has updated.
+	bool bMontageSearchPending{false};
+	FTraversableCheckResult PendingMontageSearchCheck;
+	EParkourActionType PendingMontageSearchAction{EParkourActionType::NoValidAction};
+	FParkourMontageSearchFence MontageSearchFence;
+	FParkourMontageSearchLaunch MontageSearchLaunch;
+
 	bool bWantsToStrafe{false};
 	bool bWantsToSprint{false};
 	bool bWantsToWalk{false};
@@ -0,0 +1,214 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Parkour/ParkourComponent.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Traversables/TraversableActor.h"
+#include <atomic>
+#include "TraversalQuerySubsystem.generated.h"
+
+//Everything a traversal check needs to know about the agent, so it can run without touching the agent's components.
+struct FTraversalQueryRequest
+{
+	FVector Location{FVector::ZeroVector};
+	FVector Forward{FVector::ForwardVector};
+	FVector Velocity{FVector::ZeroVector};
+	FQuat CapsuleRotation{FQuat::Identity};
+	float CapsuleRadius{30.0f};
+	float CapsuleHalfHeight{90.0f};
+	//Forward speed is mapped from VelocityRange onto TraceRange to get the length of the initial sweep.
+	FVector2f VelocityRange{0.0, 500.0};
+	FVector2f TraceRange{75.0, 180.0};
+	const AActor* IgnoredActor{nullptr};
+
+	float GetForwardTraceDistance() const
+	{
+		return FMath::GetMappedRangeValueClamped(VelocityRange, TraceRange, static_cast<float>(Velocity | Forward));
+	}
+};
+
+struct FTraversalQueryResult
+{
+	FTraversableCheckResult TraversalCheck;
+	EParkourActionType ParkourAction{EParkourActionType::NoValidAction};
+	//The sweeps found a traversable with room to move onto it.
+	bool bHasTraversal{false};
+	//The obstacle also fits one of the parkour actions.
+	bool bCanTraverse{false};
+};
+
+//What the world ledge index says about the initial sweep.
+enum class EInitialLedgeLookup : uint8
+{
+	//The index is off or doesn't exist, or it only gates the sweep, either way the sweep has to run.
+	Sweep,
+	//Nothing is indexed ahead of the agent, the sweep can be skipped.
+	NoLedge,
+	//A ledge is ahead and the hit built from it stands in for the sweep.
+	Found
+};
+
+using FTraversalQueryCallback = TFunction<void(const FTraversalQueryResult&)>;
+
+//An approach to one ledge of one traversable, the agent's location and heading are quantized in the actor's space.
+struct FTraversalCacheKey
+{
+	TObjectKey<ATraversableActor> Traversable;
+	//The instance of an instanced traversable, the approach is quantized in that instance's space.
+	int32 Item{INDEX_NONE};
+	int32 LedgeIndex{INDEX_NONE};
+	FIntVector Approach{FIntVector::ZeroValue};
+	int32 YawBucket{0};
+
+	bool operator==(const FTraversalCacheKey& Other) const
+	{
+		return Traversable == Other.Traversable && Item == Other.Item && LedgeIndex == Other.LedgeIndex &&
+			Approach == Other.Approach && YawBucket == Other.YawBucket;
+	}
+
+	friend uint32 GetTypeHash(const FTraversalCacheKey& Key)
+	{
+		return HashCombine(HashCombine(HashCombine(GetTypeHash(Key.Traversable), GetTypeHash(Key.Item)),
+		                               GetTypeHash(Key.LedgeIndex)),
+		                   HashCombine(GetTypeHash(Key.Approach), GetTypeHash(Key.YawBucket)));
+	}
+};
+
+struct FTraversalCacheEntry
+{
+	//The full check, room sweeps included. A hit only overlaps the landing capsule again and redoes the action.
+	FTraversableCheckResult TraversalCheck;
+	EParkourActionType ParkourAction{EParkourActionType::NoValidAction};
+	//The entry only holds while the ledges stay where they were and are unchanged.
+	FTransform LedgeToWorld;
+	uint32 LedgeVersion{0};
+};
+
+struct FTraversalCacheStats
+{
+	uint64 Hits{0};
+	uint64 Misses{0};
+	//Found in the cache but the traversable moved or its ledges changed.
+	uint64 Invalidations{0};
+	//Found and still valid, but the landing is blocked now or the exact height picks another action, so the full check
+	//ran instead. Also counted as a miss.
+	uint64 RevalidationFailures{0};
+
+	double GetHitRate() const
+	{
+		const uint64 Lookups = Hits + Misses;
+		return Lookups ? static_cast<double>(Hits) / Lookups : 0.0;
+	}
+};
+
+struct FTraversalQueryRecord
+{
+	TWeakObjectPtr<const UObject> Owner;
+	FTraversalQueryCallback OnComplete;
+};
+
+//Runs traversal checks for many agents in one pass.
+//The sweeps of a batch are issued together and every phase runs across the task graph, so a crowd of AI parkour
+//characters costs one parallel pass on the game thread instead of a blocking check per agent.
+UCLASS()
+class GAMEANIMATIONSAMPLE_API UTraversalQuerySubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	//Queued until the next tick, the callback is skipped if the owner is gone by then.
+	void SubmitQuery(const UObject* Owner, const FTraversalQueryRequest& Request, FTraversalQueryCallback OnComplete);
+
+	//Runs a batch right away, OutResults has to be as large as Requests. Safe to call from the game thread only.
+	void RunQueries(TConstArrayView<FTraversalQueryRequest> Requests, TArrayView<FTraversalQueryResult> OutResults);
+
+	//A full traversal check that reuses earlier results for the same approach, safe to call from any thread.
+	bool PerformCachedTraversalCheck(const FTraversalQueryRequest& Request, FTraversalQueryResult& OutResult,
+	                                 bool bDebugEnabled);
+
+	FTraversalCacheStats GetCacheStats() const;
+	void ResetCache();
+
+	int32 GetNumPendingQueries() const { return PendingRequests.Num(); }
+
+	//The blocking single agent check every path shares, it only reads the world so it can run off the game thread.
+	static bool PerformTraversalCheck(const UWorld* World, const FTraversalQueryRequest& Request,
+	                                  FTraversableCheckResult& OutTraversalCheck, bool bDebugEnabled);
+
+	//The phases of a traversal check, exposed so the batched and async paths can schedule them differently.
+	static bool SweepInitial(const UWorld* World, const FTraversalQueryRequest& Request, FHitResult& OutHit,
+	                         bool bDebugEnabled);
+	//The initial sweep, or the world ledge index in its place depending on Parkour.LedgeIndex.InitialSweep.
+	static bool FindInitialHit(const UWorld* World, const FTraversalQueryRequest& Request, FHitResult& OutHit,
+	                           bool bDebugEnabled);
+	static EInitialLedgeLookup LookupInitialLedge(const UWorld* World, const FTraversalQueryRequest& Request,
+	                                              FHitResult& OutHit);
+	static bool EvaluateLedges(const FTraversalQueryRequest& Request, const FHitResult& InitialHit,
+	                           FTraversableCheckResult& OutTraversalCheck);
+	//The same with the hit placement of the traversable and its closest ledge already found.
+	static bool EvaluateLedges(const FTraversalQueryRequest& Request, const FHitResult& InitialHit,
+	                           const ATraversableActor& Traversable, const FTransform& LedgeToWorld,
+	                           int32 ClosestLedge, FTraversableCheckResult& OutTraversalCheck);
+	static bool SweepRoom(const UWorld* World, const FTraversalQueryRequest& Request,
+	                      FTraversableCheckResult& InOutTraversalCheck, bool bDebugEnabled);
+	//True when there's room for the capsule above the front ledge.
+	static bool SweepFrontLedgeRoom(const UWorld* World, const FTraversalQueryRequest& Request,
+	                                const FTraversableCheckResult& TraversalCheck, bool bDebugEnabled);
+
+	static FCollisionQueryParams MakeQueryParams(const FTraversalQueryRequest& Request);
+	static FVector GetLedgeRoomCheckLocation(const FVector& LedgeLocation, const FVector& LedgeNormal,
+	                                         float CapsuleRadius, float CapsuleHalfHeight);
+	static FVector GetBackFloorCheckLocation(const FTraversableCheckResult& TraversalCheck, float CapsuleRadius,
+	                                         float CapsuleHalfHeight);
+	//Where the capsule ends up for the action, one of the spots the room sweeps found clear.
+	static FVector GetLandingCheckLocation(const FTraversableCheckResult& TraversalCheck,
+	                                       EParkourActionType ParkourAction, float CapsuleRadius,
+	                                       float CapsuleHalfHeight);
+	//The floor hit only counts when the back ledge room sweep was clear.
+	static void ApplyBackLedgeHits(FTraversableCheckResult& TraversalCheck, const FHitResult& BackLedgeRoomHit,
+	                               const FHitResult& FloorHit);
+	static void DrawTrace(const UWorld* World, const FCollisionShape& TraceCapsule, const FVector& TraceStart,
+	                      const FVector& TraceEnd, const FHitResult& Hit, FColor DebugColor, float DebugDuration);
+
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+protected:
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+
+	//Everything after the initial sweep and the closest ledge search, served from the cache when possible.
+	void ResolveTraversal(const FTraversalQueryRequest& Request, const FHitResult& InitialHit,
+	                      const ATraversableActor& Traversable, const FTransform& LedgeToWorld, int32 ClosestLedge,
+	                      FTraversalQueryResult& OutResult, bool bDebugEnabled);
+	bool FindCachedTraversal(const FTraversalCacheKey& Key, const ATraversableActor& Traversable,
+	                         const FTransform& LedgeToWorld, FTraversalCacheEntry& OutEntry);
+	void AddCachedTraversal(const FTraversalCacheKey& Key, const ATraversableActor& Traversable,
+	                        const FTransform& LedgeToWorld, const FTraversalQueryResult& Result);
+	void RemoveCachedTraversal(const FTraversalCacheKey& Key);
+	//The room sweeps and the action, what a cache hit skips.
+	static void FinishTraversal(const UWorld* World, const FTraversalQueryRequest& Request,
+	                            FTraversalQueryResult& InOutResult, bool bDebugEnabled);
+	//The cheap check a cache hit gets instead: the exact height still gives the cached action and one overlap finds
+	//the landing clear.
+	static bool RevalidateTraversal(const UWorld* World, const FTraversalQueryRequest& Request,
+	                                FTraversalQueryResult& InOutResult);
+
+	//Batched queries hit the cache from several workers at once.
+	mutable FRWLock CacheLock;
+	TMap<FTraversalCacheKey, FTraversalCacheEntry> Cache;
+	std::atomic<uint64> CacheHits{0};
+	std::atomic<uint64> CacheMisses{0};
+	std::atomic<uint64> CacheInvalidations{0};
+	std::atomic<uint64> CacheRevalidationFailures{0};
+
+	//Requests and their records are kept side by side so a batch can be handed to RunQueries as is.
+	TArray<FTraversalQueryRequest> PendingRequests;
+	TArray<FTraversalQueryRecord> PendingRecords;
+
+	//Scratch reused every tick.
+	TArray<FTraversalQueryRequest> RunningRequests;
+	TArray<FTraversalQueryRecord> RunningRecords;
+	TArray<FTraversalQueryResult> Results;
+};
@@ -0,0 +1,46 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+class UAnimMontage;
+
+//What motion warping needs from a traversal montage, read once from its warp notifies and Distance_From_Ledge curve.
+struct FTraversalWarpMetadata
+{
+	//End of the first warp window for each target, where the distance curve is sampled.
+	float BackLedgeWindowEnd{0.0f};
+	float BackFloorWindowEnd{0.0f};
+	//Distance_From_Ledge at those times, zero when the montage has no window for the target.
+	float BackLedgeDistance{0.0f};
+	float BackFloorDistance{0.0f};
+	bool bHasBackLedgeWarp{false};
+	bool bHasBackFloorWarp{false};
+};
+
+//Warp metadata for every traversal montage seen so far, packed in one array with a montage to index map.
+class GAMEANIMATIONSAMPLE_API FTraversalWarpTable
+{
+public:
+	const FTraversalWarpMetadata* Find(const UAnimMontage* Montage) const;
+	//Bakes the montage the first time it's asked for.
+	const FTraversalWarpMetadata& FindOrAdd(const UAnimMontage* Montage);
+	void Remove(const UAnimMontage* Montage);
+	void Reset();
+
+	int32 Num() const { return Entries.Num(); }
+	SIZE_T GetAllocatedSize() const
+	{
+		return Indices.GetAllocatedSize() + Entries.GetAllocatedSize() + Keys.GetAllocatedSize();
+	}
+
+	//Scans the notifies and samples the curve, what every traversal used to do before playing the montage.
+	static FTraversalWarpMetadata BakeMetadata(const UAnimMontage* Montage);
+
+private:
+	TMap<TObjectKey<UAnimMontage>, int32> Indices;
+	TArray<FTraversalWarpMetadata> Entries;
+	//Parallel to Entries, for fixing up the moved entry's index on removal.
+	TArray<TObjectKey<UAnimMontage>> Keys;
+};
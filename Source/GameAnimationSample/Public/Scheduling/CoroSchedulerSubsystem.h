@@ -0,0 +1,156 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CoroStateMachine/CoroTimerWheel.h"
+#include "Engine/EngineBaseTypes.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "CoroSchedulerSubsystem.generated.h"
+
+struct CoroStateMachine;
+class UCoroSchedulerSubsystem;
+
+DECLARE_STATS_GROUP(TEXT("CoroScheduler"), STATGROUP_CoroScheduler, STATCAT_Advanced);
+
+USTRUCT()
+struct FCoroSchedulerTickFunction : public FTickFunction
+{
+	GENERATED_BODY()
+
+	UCoroSchedulerSubsystem* Scheduler{nullptr};
+
+	virtual void ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread,
+	                         const FGraphEventRef& MyCompletionGraphEvent) override;
+	virtual FString DiagnosticMessage() override;
+};
+
+template <>
+struct TStructOpsTypeTraits<FCoroSchedulerTickFunction> : public TStructOpsTypeTraitsBase2<FCoroSchedulerTickFunction>
+{
+	enum
+	{
+		WithCopy = false
+	};
+};
+
+struct FCoroSchedulerRecord
+{
+	CoroStateMachine* Machine{nullptr};
+	TWeakObjectPtr<UObject> Owner;
+	//Applies world mutations the machine recorded during Run, always on the game thread.
+	TFunction<void()> FlushCommands;
+	//Flushes happen in registration order so parallel runs stay deterministic.
+	uint32 RegistrationId{0};
+	//Frames in a row this machine was skipped because the budget ran out.
+	uint32 FramesDeferred{0};
+	bool bRunInParallel{false};
+};
+
+//A machine's place in the budgeted run order. Players go first, then starving machines longest deferred first, then
+//the rest by how close they are to a viewer.
+struct FCoroBudgetedRun
+{
+	CoroStateMachine* Machine{nullptr};
+	bool bPlayer{false};
+	bool bStarving{false};
+	uint32 FramesDeferred{0};
+	//Negative squared distance to the closest viewer.
+	float Priority{0.0f};
+
+	bool MustRun() const { return bPlayer || bStarving; }
+
+	bool RunsBefore(const FCoroBudgetedRun& Other) const
+	{
+		if (bPlayer != Other.bPlayer)
+		{
+			return bPlayer;
+		}
+		if (bStarving != Other.bStarving)
+		{
+			return bStarving;
+		}
+		if (bStarving && FramesDeferred != Other.FramesDeferred)
+		{
+			return FramesDeferred > Other.FramesDeferred;
+		}
+		return Priority > Other.Priority;
+	}
+};
+
+//Parks machines that are asleep with nothing to evaluate and brings them back when their timer or event fires.
+struct FCoroSchedulerSleepHost : public CoroSleepHost
+{
+	UCoroSchedulerSubsystem* Scheduler{nullptr};
+
+	virtual void OnMachineSuspended(CoroStateMachine& Machine) override;
+	virtual void OnMachineWoken(CoroStateMachine& Machine) override;
+
+	//Parking reshuffles the records, during the parallel phase it's queued and replayed on the game thread.
+	void FlushPendingParking();
+
+	FCriticalSection PendingLock;
+	TArray<TPair<CoroStateMachine*, bool>> PendingParking;
+	bool bDeferParking{false};
+};
+
+//Runs every registered state machine from one tick function instead of one component tick per character.
+UCLASS()
+class GAMEANIMATIONSAMPLE_API UCoroSchedulerSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	//A machine run in parallel must only read the world during Run, FlushCommands then applies what it recorded.
+	void RegisterMachine(CoroStateMachine& Machine, UObject* Owner, TFunction<void()> FlushCommands = nullptr,
+	                     bool bRunInParallel = false);
+	void UnregisterMachine(CoroStateMachine& Machine);
+	void RunMachines(float DeltaTime);
+
+	int32 GetNumMachines() const { return Records.Num(); }
+	int32 GetNumActiveMachines() const { return NumActive; }
+	int32 GetLastFrameDeferredCount() const { return LastFrameDeferredCount; }
+
+	void ParkMachine(const CoroStateMachine& Machine);
+	void UnparkMachine(const CoroStateMachine& Machine);
+
+	//Makes Dependent wait every frame until all machines ran and flushed their commands.
+	void AddRunPrerequisite(FTickFunction& Dependent);
+
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+	virtual void Deinitialize() override;
+
+protected:
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+
+	FCoroSchedulerTickFunction TickFunction;
+
+	void RunAllMachines();
+	void RunOrQueueMachine(FCoroSchedulerRecord& Record);
+	void RunParallelBatch();
+	//Looks the record up again, parking may have moved it while the machine ran.
+	void FlushMachine(const CoroStateMachine& Machine);
+	void RunMachinesWithinBudget(double BudgetSeconds);
+	void BuildBudgetedRunOrder();
+
+	void SwapRecords(int32 A, int32 B);
+	void RemoveRecordAt(int32 Index);
+
+	FCoroSchedulerSleepHost SleepHost;
+
+	//Contiguous so the batch loop walks memory linearly.
+	//Active records come first, parked machines are kept past NumActive and cost nothing until they wake.
+	TArray<FCoroSchedulerRecord> Records;
+	int32 NumActive{0};
+
+	//Scratch for the budgeted mode, sorted by RunsBefore. Pointers because records move when machines park.
+	TArray<FCoroBudgetedRun> BudgetedRunOrder;
+	int32 LastFrameDeferredCount{0};
+
+	//Machines queued for the parallel phase this frame, ordered by registration id before flushing.
+	TArray<TPair<uint32, CoroStateMachine*>> ParallelBatch;
+	uint32 NextRegistrationId{0};
+
+	bool bRunningMachines{false};
+	bool bHasPendingRemovals{false};
+};
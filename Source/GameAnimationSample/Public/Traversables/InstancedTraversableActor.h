@@ -0,0 +1,35 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Traversables/TraversableActor.h"
+#include "InstancedTraversableActor.generated.h"
+
+class UHierarchicalInstancedStaticMeshComponent;
+
+//One actor for any number of repeated obstacles like fences, crates and railings.
+//The ledge splines are a template authored around a single mesh at the actor's origin, every instance of the mesh
+//shares the packed template and a hit resolves to its instance's transform. Ledge lengths are measured in template
+//space, so instances are expected to be unscaled.
+UCLASS()
+class GAMEANIMATIONSAMPLE_API AInstancedTraversableActor : public ATraversableActor
+{
+	GENERATED_BODY()
+
+public:
+	AInstancedTraversableActor();
+
+	virtual FTransform GetLedgeSpaceForHit(const FHitResult& Hit) const override;
+	virtual void GetLedgeInstances(TArray<FLedgeInstance>& OutInstances) const override;
+
+	//Call after adding, removing or moving instances at runtime.
+	UFUNCTION(BlueprintCallable)
+	void MarkInstancesChanged() { NotifyLedgesChanged(); }
+
+	//What every instance costs on top of the shared ledges.
+	SIZE_T GetInstanceAllocatedSize() const;
+
+	UPROPERTY(VisibleAnywhere, BlueprintReadOnly)
+	TObjectPtr<UHierarchicalInstancedStaticMeshComponent> InstancedMesh;
+};
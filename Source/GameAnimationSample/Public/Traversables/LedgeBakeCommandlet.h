@@ -0,0 +1,25 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "LedgeBakeCommandlet.generated.h"
+
+//Finds the ledges of every traversable in a level from the collision of its static meshes and saves them as packed
+//ledge data, so the splines don't have to be authored by hand and nothing is computed at runtime.
+//Top edges are the boundary between faces pointing up and the walls below them, edges across the top from each other
+//become opposite ledges. Actors whose collision didn't change since their last bake are skipped.
+//
+//	UnrealEditor-Cmd <Project> -run=LedgeBake -Map=/Game/Levels/A,/Game/Levels/B -nullrhi [-Force]
+//	                 [-MaxSlope=30] [-MinLedgeLength=30] [-MaxOppositeHeight=50]
+UCLASS()
+class GAMEANIMATIONSAMPLE_API ULedgeBakeCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	ULedgeBakeCommandlet();
+
+	virtual int32 Main(const FString& Params) override;
+};
@@ -0,0 +1,51 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+//The closest segment found so far for one query point.
+struct FLedgeSegmentHit
+{
+	float DistanceSquared{TNumericLimits<float>::Max()};
+	int32 Segment{INDEX_NONE};
+	//Position of the closest point between the segment's start and end.
+	float Alpha{0.0f};
+
+	bool IsValid() const { return Segment != INDEX_NONE; }
+};
+
+//Straight segments split into one array per component, so four of them, or four query points against one of them,
+//fill a vector register. Every array is padded past the last segment, a four wide load from any segment is in bounds.
+struct FLedgeSegmentLanes
+{
+	TArray<float> StartX;
+	TArray<float> StartY;
+	TArray<float> StartZ;
+	TArray<float> DirectionX;
+	TArray<float> DirectionY;
+	TArray<float> DirectionZ;
+	//Zero for degenerate segments, which then always resolve to their start.
+	TArray<float> InvLengthSquared;
+
+	int32 Num() const { return NumSegments; }
+	bool IsEmpty() const { return NumSegments == 0; }
+
+	void Reset();
+	void Reserve(int32 InNum);
+	void Add(const FVector3f& Start, const FVector3f& End);
+	//Call once every segment is added, before querying.
+	void Pad();
+	SIZE_T GetAllocatedSize() const;
+
+	FVector3f GetLocation(const FLedgeSegmentHit& Hit) const;
+
+	//Tests one point against four segments at a time. InOutHit is only replaced by something closer.
+	void FindClosest(int32 First, int32 Count, const FVector3f& Point, FLedgeSegmentHit& InOutHit) const;
+	//Tests four points at a time against one segment at a time, for many points against the same segments.
+	void FindClosestBatch(int32 First, int32 Count, TConstArrayView<FVector3f> Points,
+	                      TArrayView<FLedgeSegmentHit> InOutHits) const;
+
+private:
+	int32 NumSegments{0};
+};
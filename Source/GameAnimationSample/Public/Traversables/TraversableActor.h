@@ -5,6 +5,7 @@
 #include "CoreMinimal.h"
 #include "Components/SplineComponent.h"
 #include "GameFramework/Actor.h"
+#include "Traversables/LedgeSegmentLanes.h"
 #include "TraversableActor.generated.h"
 
 USTRUCT(BlueprintType)
@@ -32,19 +33,220 @@ struct FTraversableCheckResult
 	TObjectPtr<UPrimitiveComponent> HitComponent;
 };
 
+//A straight piece of a baked ledge in actor space, already raised along the ledge's up vector like the closest ledge
+//search expects.
+struct FLedgeSegment
+{
+	FVector3f Start{FVector3f::ZeroVector};
+	FVector3f End{FVector3f::ZeroVector};
+	int32 LedgeIndex{INDEX_NONE};
+	//The packed point the segment starts at.
+	int32 Point{INDEX_NONE};
+};
+
+//Leaves own a range of segments, interior nodes keep their left child right after them.
+struct FLedgeBVHNode
+{
+	FBox3f Bounds{ForceInit};
+	//First segment for a leaf, the right child for an interior node.
+	int32 FirstIndex{0};
+	int32 NumSegments{0};
+
+	bool IsLeaf() const { return NumSegments > 0; }
+};
+
+//Every ledge of a traversable packed into flat arrays, built from the ledge splines in the editor and saved with
+//the actor, so nothing at runtime has to evaluate a spline component.
+USTRUCT()
+struct FCompactLedgeData
+{
+	GENERATED_BODY()
+
+	//Ledge i owns the points in [PointOffsets[i], PointOffsets[i + 1]), taken at even steps along its spline.
+	UPROPERTY()
+	TArray<int32> PointOffsets;
+	UPROPERTY()
+	TArray<float> Lengths;
+	//Actor space. The up vector is also the ledge normal.
+	UPROPERTY()
+	TArray<FVector3f> Points;
+	UPROPERTY()
+	TArray<FVector3f> Ups;
+	//INDEX_NONE when the ledge has no opposite.
+	UPROPERTY()
+	TArray<int32> OppositeLedges;
+
+	int32 Num() const { return Lengths.Num(); }
+	bool IsEmpty() const { return Lengths.IsEmpty(); }
+	int32 GetFirstPoint(const int32 Ledge) const { return PointOffsets[Ledge]; }
+	int32 GetNumPoints(const int32 Ledge) const { return PointOffsets[Ledge + 1] - PointOffsets[Ledge]; }
+	float GetStep(const int32 Ledge) const
+	{
+		return GetNumPoints(Ledge) > 1 ? Lengths[Ledge] / (GetNumPoints(Ledge) - 1) : 0.0f;
+	}
+
+	void Reset();
+	SIZE_T GetAllocatedSize() const;
+
+	//Location and up vector at a distance along the ledge, in actor space.
+	void Evaluate(int32 Ledge, float Distance, FVector3f& OutLocation, FVector3f& OutUp) const;
+	//Distance along the ledge of its point closest to Location.
+	float FindDistanceClosestToLocation(int32 Ledge, const FVector3f& Location) const;
+};
+
+//Where the opposite ledge is, seen from one point of a front ledge, in actor space.
+struct FLedgeCorrespondenceSample
+{
+	FVector3f BackLocation{FVector3f::ZeroVector};
+	FVector3f BackNormal{FVector3f::UpVector};
+	//Horizontal distance from the front ledge to the back ledge.
+	float Depth{0.0f};
+};
+
+//Samples of the opposite ledge taken at even steps along a front ledge, empty when the ledge has no opposite.
+struct FLedgeCorrespondence
+{
+	float SampleStep{0.0f};
+	TArray<FLedgeCorrespondenceSample> Samples;
+
+	bool HasOppositeLedge() const { return !Samples.IsEmpty(); }
+
+	//Interpolates between the two samples around DistanceAlongFront.
+	FLedgeCorrespondenceSample Evaluate(float DistanceAlongFront) const;
+};
+
+//The closest point on a traversable's ledges to one location, in world space.
+struct FLedgeClosestPoint
+{
+	int32 LedgeIndex{INDEX_NONE};
+	FVector Location{FVector::ZeroVector};
+	FVector Up{FVector::UpVector};
+	//Measured from the point raised above the ledge that the closest ledge search ranks by.
+	float Distance{0.0f};
+};
+
+//One placement of a traversable's ledges. A plain traversable has one, an instanced one has one per instance.
+struct FLedgeInstance
+{
+	FTransform LedgeToWorld;
+	//The instance index a hit on this placement reports in FHitResult::Item, INDEX_NONE if there's only one.
+	int32 Item{INDEX_NONE};
+};
+
 UCLASS()
 class GAMEANIMATIONSAMPLE_API ATraversableActor : public AActor
 {
 	GENERATED_BODY()
 
 public:
+	virtual void OnConstruction(const FTransform& Transform) override;
+	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+	//Searches the baked ledge segments, safe to call from any thread.
+	int32 FindClosestLedgeIndexToLocation(const FVector& Location) const;
+	//The same search with the ledges placed somewhere other than the actor.
+	int32 FindClosestLedgeIndex(const FTransform& LedgeToWorld, const FVector& Location) const;
+	//The closest ledge search for many locations at once, like a crowd of AI checking the same obstacle.
+	void FindClosestLedges(const FTransform& LedgeToWorld, TConstArrayView<FVector> Locations,
+	                       TArrayView<FLedgeClosestPoint> OutClosest) const;
+	//Evaluates every spline, kept as the reference for the baked search.
+	int32 FindClosestLedgeIndexBySpline(const FVector& Location) const;
 	USplineComponent* FindClosestLedgeToLocation(const FVector& Location);
 	UFUNCTION(BlueprintCallable)
 	FTraversableCheckResult GetLedgeTransforms(FVector HitLocation, FVector ActorLocation);
 
+	//What traversal checks call, lets a traversable with several placements of its ledges pick the one that was hit.
+	virtual FTraversableCheckResult GetLedgeTransformsForHit(const FHitResult& Hit, const FVector& ActorLocation) const;
+	//The ledge transforms once the closest ledge is already known, like a batch that ran FindClosestLedges for every
+	//agent in front of this placement. Safe to call from any thread.
+	FTraversableCheckResult GetLedgeTransformsForLedge(const FTransform& LedgeToWorld, int32 ClosestIndex,
+	                                                   const FVector& HitLocation) const;
+	//The space the packed ledges are placed in for this hit.
+	virtual FTransform GetLedgeSpaceForHit(const FHitResult& Hit) const { return GetActorTransform(); }
+	//Every placement of the packed ledges in the world.
+	virtual void GetLedgeInstances(TArray<FLedgeInstance>& OutInstances) const;
+
 	UPROPERTY(BlueprintReadWrite)
 	TArray<USplineComponent*> LedgeSplines;
 
 	UPROPERTY(BlueprintReadWrite)
 	TMap<USplineComponent*, USplineComponent*> OppositeLedges;
+
+	//Call after editing LedgeSplines or OppositeLedges at runtime, the compact ledges are rebuilt from them and anything
+	//derived from the old ledges is thrown away.
+	UFUNCTION(BlueprintCallable)
+	void MarkLedgesChanged();
+
+	uint32 GetLedgeVersion() const { return LedgeVersion; }
+
+	//Rebuilds the ledge segments, their BVH and the front to back tables if the ledges changed since the last bake.
+	void BakeLedges() const;
+
+	//Packs LedgeSplines and OppositeLedges into LedgeData, unless the ledges were baked from collision.
+	void BuildLedgeData();
+	//Replaces the packed ledges with ones baked from collision, the splines are ignored from then on.
+	void SetBakedLedgeData(FCompactLedgeData&& InLedgeData, uint32 SourceHash);
+	bool AreLedgesBakedFromCollision() const { return bLedgesBakedFromCollision; }
+	//What the collision the ledges were baked from hashed to, so unchanged actors can be skipped.
+	uint32 GetBakedLedgeSourceHash() const { return BakedLedgeSourceHash; }
+	const FCompactLedgeData& GetLedgeData() const { return LedgeData; }
+	//What the segments, BVH and tables derived from LedgeData take up.
+	SIZE_T GetBakedLedgeAllocatedSize() const;
+	//What the ledge spline components and the maps pointing at them take up.
+	SIZE_T GetLedgeSplineAllocatedSize() const;
+
+	int32 GetNumLedgeSegments() const { return LedgeSegments.Num(); }
+	//A copy of the baked segments in actor space.
+	void GetLedgeSegments(TArray<FLedgeSegment>& OutSegments) const;
+
+	//Spacing of the samples taken along each ledge spline when baking it into segments.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, meta=(ClampMin=1.0f, Units="cm"))
+	float LedgeBakeSpacing{25.0f};
+
+	//Destroys the ledge spline components once play begins, the compact ledges are all traversal needs.
+	UPROPERTY(EditAnywhere, BlueprintReadOnly)
+	bool bDiscardLedgeSplinesAtRuntime{false};
+
+protected:
+#if WITH_EDITOR
+	virtual void PreSave(FObjectPreSaveContext ObjectSaveContext) override;
+#endif
+
+	//Bumps the version and updates the world ledge index, without rebuilding the packed ledges.
+	void NotifyLedgesChanged();
+
+	FTraversableCheckResult GetLedgeTransformsInSpace(const FTransform& LedgeToWorld, const FVector& HitLocation,
+	                                                  const FVector& ActorLocation) const;
+
+	void BakeLedgesLocked() const;
+	int32 BuildLedgeBVH(int32 Begin, int32 End) const;
+	void BakeLedgeCorrespondence(int32 FrontLedge, int32 BackLedge, FLedgeCorrespondence& OutCorrespondence) const;
+	//Distance along the ledge of its point closest to Location, in ledge space. Needs LedgeIndexLock.
+	float FindDistanceAlongLedgeLocked(int32 Ledge, const FVector3f& Location) const;
+
+	uint32 LedgeVersion{0};
+
+	UPROPERTY()
+	FCompactLedgeData LedgeData;
+
+	//Set by the ledge bake commandlet.
+	UPROPERTY(VisibleAnywhere, AdvancedDisplay)
+	bool bLedgesBakedFromCollision{false};
+	UPROPERTY(VisibleAnywhere, AdvancedDisplay)
+	uint32 BakedLedgeSourceHash{0};
+
+	bool bLedgeSplinesDiscarded{false};
+
+	//Derived from LedgeData, rebuilt on demand so batched queries on worker threads never see a half built index.
+	mutable FRWLock LedgeIndexLock;
+	mutable TArray<FLedgeSegment> LedgeSegments;
+	mutable TArray<FLedgeBVHNode> LedgeBVH;
+	//LedgeSegments in the same order, for the vectorized leaf tests.
+	mutable FLedgeSegmentLanes LedgeSegmentLanes;
+	//One segment per packed point to the next, unraised, so ledge i's segments start at its first point.
+	mutable FLedgeSegmentLanes LedgePointLanes;
+	//One per ledge.
+	mutable TArray<FLedgeCorrespondence> LedgeCorrespondences;
+	mutable uint32 BakedLedgeVersion{MAX_uint32};
 };
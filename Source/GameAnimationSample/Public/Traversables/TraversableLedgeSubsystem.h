@@ -0,0 +1,120 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Components/SceneComponent.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "TraversableLedgeSubsystem.generated.h"
+
+class ATraversableActor;
+
+//A piece of a ledge in world space, with the traversable and ledge it was baked from.
+struct FWorldLedgeSegment
+{
+	FVector Start{FVector::ZeroVector};
+	FVector End{FVector::ZeroVector};
+	TWeakObjectPtr<ATraversableActor> Traversable;
+	int32 LedgeIndex{INDEX_NONE};
+	//Which instance of an instanced traversable the segment belongs to.
+	int32 Item{INDEX_NONE};
+};
+
+//A box swept forward from the origin, roughly the volume a capsule sweep would cover.
+struct FLedgeQuery
+{
+	FVector Origin{FVector::ZeroVector};
+	//Flattened onto the ground plane.
+	FVector Direction{FVector::ForwardVector};
+	float Length{0.0f};
+	float HalfWidth{0.0f};
+	//Relative to the origin.
+	float MinHeight{0.0f};
+	float MaxHeight{0.0f};
+};
+
+struct FLedgeQueryResult
+{
+	TWeakObjectPtr<ATraversableActor> Traversable;
+	int32 LedgeIndex{INDEX_NONE};
+	int32 Item{INDEX_NONE};
+	//The point of the ledge inside the query volume that is nearest along the query direction.
+	FVector Location{FVector::ZeroVector};
+	float Distance{0.0f};
+};
+
+//Uniform grid over ledge segments. A segment is stored in every cell its bounds touch.
+class GAMEANIMATIONSAMPLE_API FLedgeSegmentGrid
+{
+public:
+	explicit FLedgeSegmentGrid(float InCellSize = 200.0f);
+
+	int32 Add(const FWorldLedgeSegment& Segment);
+	void Remove(int32 SegmentId);
+	void Reset();
+
+	//The ledge nearest along the query direction, only looks at the cells the query volume touches.
+	bool FindBest(const FLedgeQuery& Query, FLedgeQueryResult& OutResult) const;
+	//Tests every segment, the reference the grid is measured against.
+	bool FindBestBruteForce(const FLedgeQuery& Query, FLedgeQueryResult& OutResult) const;
+
+	//Clips the segment against the query volume, Distance is how far along the query its nearest part is.
+	static bool ClipSegment(const FLedgeQuery& Query, const FWorldLedgeSegment& Segment, FLedgeQueryResult& OutResult);
+
+	int32 GetNumSegments() const { return Segments.Num(); }
+	int32 GetNumCells() const { return Cells.Num(); }
+	float GetCellSize() const { return CellSize; }
+
+private:
+	FIntVector ToCell(const FVector& Location) const;
+	void GetCellRange(const FWorldLedgeSegment& Segment, FIntVector& OutMin, FIntVector& OutMax) const;
+
+	float CellSize;
+	TSparseArray<FWorldLedgeSegment> Segments;
+	TMap<FIntVector, TArray<int32>> Cells;
+};
+
+//Indexes the ledges of every traversable in the world, so the ledge ahead of an agent can be found without a sweep.
+//Traversables register themselves on BeginPlay, and the index follows them when they move or their ledges change.
+UCLASS()
+class GAMEANIMATIONSAMPLE_API UTraversableLedgeSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+
+	void RegisterTraversable(ATraversableActor* Traversable);
+	void UnregisterTraversable(ATraversableActor* Traversable);
+	//Rebakes the traversable's segments into the grid, does nothing if it isn't registered.
+	void UpdateTraversable(ATraversableActor* Traversable);
+
+	//Safe to call from any thread.
+	bool FindBestLedge(const FLedgeQuery& Query, FLedgeQueryResult& OutResult) const;
+
+	//The component a sweep would have hit on this traversable, stands in for the hit when the sweep is skipped.
+	UPrimitiveComponent* GetCollisionComponent(const ATraversableActor* Traversable) const;
+
+	int32 GetNumSegments() const { return Grid.GetNumSegments(); }
+
+protected:
+	virtual bool DoesSupportWorldType(const EWorldType::Type WorldType) const override;
+
+	void AddSegments(ATraversableActor* Traversable, TArray<int32>& OutSegmentIds);
+	void RemoveSegments(TArray<int32>& SegmentIds);
+	void OnTraversableMoved(USceneComponent* UpdatedComponent, EUpdateTransformFlags UpdateTransformFlags,
+	                        ETeleportType Teleport);
+
+	struct FRegisteredTraversable
+	{
+		TArray<int32> SegmentIds;
+		TWeakObjectPtr<UPrimitiveComponent> CollisionComponent;
+		TWeakObjectPtr<USceneComponent> Root;
+		FDelegateHandle TransformUpdatedHandle;
+	};
+
+	mutable FRWLock GridLock;
+	FLedgeSegmentGrid Grid;
+	TMap<TObjectKey<ATraversableActor>, FRegisteredTraversable> Traversables;
+};